@@ -0,0 +1,29 @@
+//
+// Simple bump allocator over a caller-provided block of memory
+//
+
+#include "arena.h"
+
+
+void arena_init(arena *a, void *base, size_t size) {
+  a->base = base;
+  a->size = size;
+  a->used = 0;
+}
+
+void *arena_alloc(arena *a, size_t size, size_t align) {
+  // Align the absolute address, not just the offset into the arena
+  uintptr_t addr = (uintptr_t)(a->base + a->used);
+  size_t pad = (align - (addr & (align - 1))) & (align - 1);
+  if ((size > a->size) || (a->used + pad > a->size - size)) {
+    return NULL;
+  }
+  void *p = a->base + a->used + pad;
+  a->used += pad + size;
+  return p;
+}
+
+void arena_reset(arena *a) {
+  a->used = 0;
+}
+
@@ -0,0 +1,38 @@
+//
+// Simple bump allocator over a caller-provided block of memory
+//
+// On the RP2040 the audio buffers are the bulk of the emulator's SRAM use,
+// so the firmware hands us one statically allocated block and the buffers
+// are carved out of it. Nothing is ever freed individually; the whole
+// arena is discarded (or reset) at once.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// State of arena
+typedef struct {
+  uint8_t *base;  // Start of caller-provided memory
+  size_t   size;  // Size of memory in bytes
+  size_t   used;  // Bytes handed out so far
+} arena;
+
+// Initialize an arena over caller-provided memory
+// Params: a - arena to initialize [OUT]
+//         base - memory to allocate from
+//         size - size of memory in bytes
+void arena_init(arena *a, void *base, size_t size);
+
+// Allocate from an arena
+// Params: a - arena
+//         size - number of bytes required
+//         align - required alignment, must be a power of two
+// Returns pointer to memory, or NULL if the arena is exhausted
+void *arena_alloc(arena *a, size_t size, size_t align);
+
+// Release everything allocated from an arena
+// Params: a - arena
+void arena_reset(arena *a);
+
@@ -0,0 +1,378 @@
+//
+// Reference emulation of General Instruments AY-3-8913 Sound Chip
+//
+
+#include "ay-3-8913-ref.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prototypes for private functions
+static void ay3ref_reset(ay3ref_state *h);
+static void ay3ref_set_register(ay3ref_state *h, unsigned int reg, uint8_t val);
+static uint8_t ay3ref_get_register(ay3ref_state *h, unsigned int reg);
+static void ay3ref_process(ay3ref_state *h);
+static void ay3ref_gen_noise(ay3ref_state *h);
+static void ay3ref_gen_tone(ay3ref_state *h);
+static void ay3ref_mix(ay3ref_state *h);
+static void reset_envelope_generator(ay3ref_state *h);
+static uint8_t envelope_generator(ay3ref_state *h);
+static void ay3ref_envelope_ampl(ay3ref_state *h);
+static void ay3ref_combine(ay3ref_state *h);
+
+
+ay3ref_state *create_ay3ref(const ay3_config *cfg) {
+  ay3ref_state *h = malloc(sizeof(ay3ref_state));
+  if (!h) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  if (cfg) {
+    h->cfg = *cfg;
+  } else {
+    ay3_default_config(&h->cfg);
+  }
+
+  uint64_t divider = 16;
+  if ((h->cfg.variant == AY3_VARIANT_YM2149) && h->cfg.ym_sel_div2) {
+    divider = 32;
+  }
+  if ((h->cfg.samples == 0) ||
+      (h->cfg.clockspeed == 0) ||
+      (h->cfg.chipclock > divider * h->cfg.clockspeed) ||
+      (h->cfg.samplerate > h->cfg.clockspeed)) {
+    printf("AY3: Bad config!");
+    exit(999);
+  }
+  h->tone_step   = (((uint64_t)h->cfg.chipclock << AY3_FIXED_SHIFT) +
+                    divider * h->cfg.clockspeed / 2) /
+                   (divider * h->cfg.clockspeed);
+  h->sample_step = (((uint64_t)h->cfg.samplerate << AY3_FIXED_SHIFT) +
+                    h->cfg.clockspeed / 2) /
+                   h->cfg.clockspeed;
+
+  h->output = malloc(h->cfg.samples);
+  if (!h->output) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  for (unsigned int i = 0; i < 16; ++i) {
+    h->regs[i] = 0;
+  }
+  h->blocks = 0;
+  ay3ref_reset(h);
+  return h;
+}
+
+void destroy_ay3ref(ay3ref_state *h) {
+  free(h->output);
+  free(h);
+}
+
+// Called every clock cycle
+void ay3ref_clk(ay3ref_state *h, via_state *via) {
+  uint8_t bc1   = via->hot.port_b & 0x01;
+  uint8_t bdir  = via->hot.port_b & 0x02;
+  uint8_t reset = via->hot.port_b & 0x04;
+
+  if (reset == 0) {
+    ay3ref_reset(h);
+    return;
+  }
+
+  if ((bdir == 0) && (bc1 != 0)) {
+    // Read register
+    via->hot.port_a = ay3ref_get_register(h, h->selected);
+  } else if ((bdir != 0) && (bc1 == 0)) {
+    // Write register
+    ay3ref_set_register(h, h->selected, via->hot.port_a);
+  } else if ((bdir != 0) && (bc1 != 0)) {
+    // Latch register
+    h->selected = via->hot.port_a;
+  }
+
+  // Generate signal
+  ay3ref_process(h);
+}
+
+void ay3ref_dump(ay3ref_state *h, FILE *f) {
+  fprintf(f, "  regs:");
+  for (unsigned int i = 0; i < 16; ++i) {
+    fprintf(f, " %02x", h->regs[i]);
+  }
+  fprintf(f, "  selected: R%d\n", h->selected);
+  fprintf(f, "  tone_phase: 0x%05x/0x%05x  sample_phase: 0x%05x/0x%05x\n",
+          h->tone_phase, h->tone_step, h->sample_phase, h->sample_step);
+  fprintf(f, "  idx: %u/%u  blocks: %u  level: %u\n",
+          h->idx, h->cfg.samples, h->blocks, h->level);
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    fprintf(f, "  tone %c: period %u counter %u signal %u\n",
+            'A' + ch, h->tone_state.period[ch], h->tone_state.counter[ch],
+            h->tone_state.signal[ch]);
+  }
+  fprintf(f, "  noise: period %u counter %u signal %u lfsr 0x%05x\n",
+          h->noise_state.period, h->noise_state.counter,
+          h->noise_state.signal, h->noise_state.lfsr);
+  fprintf(f, "  envelope: remaining %u period_counter %u value %u divider %u\n",
+          h->envelope_state.remaining, h->envelope_state.period_counter,
+          h->envelope_state.envelope_value, h->env_divider);
+}
+
+static void ay3ref_reset(ay3ref_state *h) {
+  h->selected = 0;
+  h->idx = 0;
+  h->tone_phase = 0;
+  h->sample_phase = 0;
+  h->env_divider = 16;
+  h->level = 0;
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    h->tone_state.period[ch]  = 4095;
+    h->tone_state.counter[ch] = 1;
+    h->tone_state.signal[ch]  = 0;
+  }
+  h->noise_state.period  = 31;
+  h->noise_state.counter = 1;
+  h->noise_state.signal  = 0;
+  h->noise_state.lfsr    = 1;
+  memset(h->output, 0, h->cfg.samples);
+  reset_envelope_generator(h);
+}
+
+static void ay3ref_set_register(ay3ref_state *h, unsigned int reg, uint8_t val) {
+  // Implemented bits of each register
+  static const uint8_t ay_mask[16] = {
+    0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+    0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0xff
+  };
+
+  if (reg > 15) {
+    // Not decoded by the chip
+    return;
+  }
+  switch (h->cfg.variant) {
+    case AY3_VARIANT_YM2149:
+      h->regs[reg] = val;
+      break;
+    case AY3_VARIANT_AY38910:
+      h->regs[reg] = val & ay_mask[reg];
+      break;
+    case AY3_VARIANT_AY38912:
+      h->regs[reg] = (reg == 15) ? 0 : val & ay_mask[reg];
+      break;
+    default:
+      h->regs[reg] = (reg >= 14) ? 0 : val & ay_mask[reg];
+      break;
+  }
+  switch (reg) {
+    case 0:
+    case 1:
+      // Changing period on channel A - calculate the updated period
+      // and reset tone generator state. Zero behaves as one.
+      h->tone_state.period[0] = h->regs[0] + ((h->regs[1] & 0x0f) << 8);
+      if (h->tone_state.period[0] == 0) {
+        h->tone_state.period[0] = 1;
+      }
+      h->tone_state.counter[0] = h->tone_state.period[0];
+      break;
+    case 2:
+    case 3:
+      // Changing period on channel B
+      h->tone_state.period[1] = h->regs[2] + ((h->regs[3] & 0x0f) << 8);
+      if (h->tone_state.period[1] == 0) {
+        h->tone_state.period[1] = 1;
+      }
+      h->tone_state.counter[1] = h->tone_state.period[1];
+      break;
+    case 4:
+    case 5:
+      // Changing period on channel C
+      h->tone_state.period[2] = h->regs[4] + ((h->regs[5] & 0x0f) << 8);
+      if (h->tone_state.period[2] == 0) {
+        h->tone_state.period[2] = 1;
+      }
+      h->tone_state.counter[2] = h->tone_state.period[2];
+      break;
+    case 6:
+      // Changing period on noise generator
+      h->noise_state.period = h->regs[6] & 0x1f;
+      if (h->noise_state.period == 0) {
+        h->noise_state.period = 1;
+      }
+      h->noise_state.counter = h->noise_state.period;
+      break;
+    case 15:
+      // Write to R15 (Envelope Shape/Cycle) resets the envelope generator
+      reset_envelope_generator(h);
+      break;
+  }
+}
+
+static uint8_t ay3ref_get_register(ay3ref_state *h, unsigned int reg) {
+  if (reg > 15) {
+    // Not decoded by the chip
+    return 0;
+  }
+  return h->regs[reg];
+}
+
+static void ay3ref_process(ay3ref_state *h) {
+
+  // Tone and noise is generated every 16 chip clocks
+  h->tone_phase += h->tone_step;
+  if (h->tone_phase >= AY3_FIXED_ONE) {
+    h->tone_phase -= AY3_FIXED_ONE;
+    ay3ref_gen_tone(h);
+    ay3ref_gen_noise(h);
+    ay3ref_mix(h);
+    ay3ref_envelope_ampl(h);
+    ay3ref_combine(h);
+  }
+
+  // Output the combined signal to output[] at the configured sample rate
+  h->sample_phase += h->sample_step;
+  if (h->sample_phase >= AY3_FIXED_ONE) {
+    h->sample_phase -= AY3_FIXED_ONE;
+    h->output[h->idx++] = h->level;
+    if (h->idx >= h->cfg.samples) {
+      h->idx = 0;
+      ++h->blocks;
+    }
+  }
+}
+
+// Three-channel squarewave generator, called every 16th clock
+static void ay3ref_gen_tone(ay3ref_state *h) {
+
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    if (--h->tone_state.counter[ch] == 0) {
+      h->tone_state.counter[ch] = h->tone_state.period[ch];
+      h->tone_state.signal[ch] = ((h->tone_state.signal[ch] == 0) ? 1 : 0);
+    }
+  }
+}
+
+// Single channel 17 bit LFSR noise generator, called every 16th clock
+static void ay3ref_gen_noise(ay3ref_state *h) {
+  if (--h->noise_state.counter == 0) {
+    h->noise_state.counter = h->noise_state.period;
+    unsigned int feedback = (h->noise_state.lfsr ^ (h->noise_state.lfsr >> 3)) & 0x01;
+    h->noise_state.lfsr = (h->noise_state.lfsr >> 1) | (feedback << 16);
+    h->noise_state.signal = h->noise_state.lfsr & 0x01;
+  }
+}
+
+// Mix the three tone channels plus noise, called every 16th clock
+static void ay3ref_mix(ay3ref_state *h) {
+
+  unsigned int en = h->regs[7];
+  unsigned int tone_en[]  = {(en & 0x01) >> 0, (en & 0x02) >> 1, (en & 0x04) >> 2};
+  unsigned int noise_en[] = {(en & 0x08) >> 3, (en & 0x10) >> 4, (en & 0x20) >> 5};
+
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    unsigned int t_en = (tone_en[ch]  == 0 ? 1 : 0);
+    unsigned int n_en = (noise_en[ch] == 0 ? 1 : 0);
+    h->mixed[ch] = t_en * h->tone_state.signal[ch] + n_en * h->noise_state.signal;
+  }
+}
+
+// Reset envelope generator state
+static void reset_envelope_generator(ay3ref_state *h) {
+  h->envelope_state.envelope_value = 0;
+  h->envelope_state.remaining = 1;
+  h->envelope_state.period_counter = 0;
+}
+
+// Generate amplitude envelope, called every 1/256th clock
+static uint8_t envelope_generator(ay3ref_state *h) {
+
+  // Period of envelope in terms of cycles of (chip clock/256)
+  unsigned int period = h->regs[11] + (h->regs[12] << 8);
+  unsigned int shape  = h->regs[13] & 0x0f;
+
+  // The YM2149 has a 32 step envelope, the GI parts 16 steps
+  unsigned int steps = (h->cfg.variant == AY3_VARIANT_YM2149) ? 32 : 16;
+  unsigned int top   = steps - 1;
+
+  // Decode the shape
+  unsigned int env_continue  = (shape & 0x08) >> 3;
+  unsigned int env_attack    = (shape & 0x04) >> 2;
+  unsigned int env_alternate = (shape & 0x02) >> 1;
+  unsigned int env_hold      = (shape & 0x01);
+
+  if (--h->envelope_state.remaining == 0) {
+    h->envelope_state.remaining = period + 1;
+    ++h->envelope_state.period_counter;
+  }
+
+  // Divide the period up into 16 (or 32) segments
+  unsigned int step = (period + 1 - h->envelope_state.remaining) * steps / (period + 1);
+
+  if (h->envelope_state.period_counter == 1) {
+    // Within the first period, the only param that matters is the attack
+    // which has the effect of inverting the signal
+    return (env_attack ? step : top - step);
+  } else {
+    // For subsequent periods 2, 3, 4 ...
+    if (!env_continue) {
+      // If continue is false, then value is zero after first period expires
+      // regardless of the other flags
+      return 0;
+    } else {
+      // We are continuing ...
+      if (env_hold) {
+        // Holding ...
+        // Value goes high if either attack is true or alternate mode is set, but not both
+        return (env_alternate ^ env_attack) * top;
+      } else {
+        // Not holding ...
+        if (!env_alternate) {
+          // Not alternating, do the same thing as initial period, again and again
+          return (env_attack ? step : top - step);
+        } else {
+          // Alternating, do the opposite thing each time
+          return (((h->envelope_state.period_counter % 2 == 0) ^ env_attack) ? step : top - step);
+        }
+      }
+    }
+  }
+}
+
+// Scale by fixed amplitude or apply envelope, called every 1/16th clock
+static void ay3ref_envelope_ampl(ay3ref_state *h) {
+
+  // Amplitude mode (0 for fixed, 1 for envelope)
+  unsigned int mode[] = {(h->regs[8]  & 0x10) >> 4,
+                         (h->regs[9]  & 0x10) >> 4,
+                         (h->regs[10] & 0x10) >> 4};
+
+  // Fixed amplitude in range 0..15
+  unsigned int ampl[] = {h->regs[8]  & 0x0f,
+                         h->regs[9]  & 0x0f,
+                         h->regs[10] & 0x0f};
+
+  // Every 16 calls, update the envelope (16*16 = every 256 clks)
+  if (--h->env_divider == 0) {
+    h->envelope_state.envelope_value = envelope_generator(h);
+    h->env_divider = 16;
+  }
+
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    if (mode[ch] == 0) {
+      // The YM2149 maps fixed amplitude N onto its 5 bit DAC as 2N+1
+      if ((h->cfg.variant == AY3_VARIANT_YM2149) && (ampl[ch] != 0)) {
+        h->mixed[ch] *= ampl[ch] * 2 + 1;
+      } else {
+        h->mixed[ch] *= ampl[ch];
+      }
+    } else {
+      h->mixed[ch] *= h->envelope_state.envelope_value;
+    }
+  }
+}
+
+// Combine the three channels into the output level, called every 1/16th clock
+static void ay3ref_combine(ay3ref_state *h) {
+  unsigned int scale = (h->cfg.variant == AY3_VARIANT_YM2149) ? 5 : 10;
+  h->level = (h->mixed[0] + h->mixed[1] + h->mixed[2]) * scale;
+}
+
@@ -0,0 +1,92 @@
+//
+// Reference emulation of General Instruments AY-3-8913 Sound Chip
+//
+// A straightforward per-clock implementation, written in the style of the
+// engine as it was before its state was split into hot and cold parts, so
+// that the optimized engine in ay-3-8913.c can be checked against it (see
+// conformance.c). It decodes the registers afresh on every generator tick
+// and makes no attempt to be fast.
+//
+// It is a rewrite, not a copy of the old code, and deliberately differs
+// from the pre-split engine in two ways, to match the optimized one:
+// - Noise comes from a 17 bit LFSR rather than rand(), so that both
+//   engines produce the same samples.
+// - Tone and noise periods of zero behave as one.
+// So it cannot catch a regression in either of those. Any change to the
+// emulated behaviour must be made here as well as in the optimized engine.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "ay-3-8913.h"
+
+// State of reference AY-3-8913
+typedef struct {
+  uint8_t regs[16];
+  uint8_t selected; // Selected register
+
+  ay3_config cfg;
+
+  // Output buffer of cfg.samples entries
+  uint8_t *output;
+
+  // Write index into output buffers
+  unsigned int idx;
+
+  // Number of times output[] has been completely filled
+  uint32_t blocks;
+
+  // Fixed-point phase accumulators, derived from cfg
+  uint32_t tone_step;    // Generator ticks per ay3ref_clk(), 16.16
+  uint32_t tone_phase;
+  uint32_t sample_step;  // Output samples per ay3ref_clk(), 16.16
+  uint32_t sample_phase;
+  unsigned int env_divider; // Generator ticks until next envelope update
+
+  // Interal state of tone generator
+  struct {
+    unsigned int period[3];   // Period in generator ticks (chip clock/16)
+    unsigned int counter[3];  // Count remaining until flip
+    unsigned int signal[3];   // Current signal state high or low
+  } tone_state;
+
+  // Interal state of noise generator
+  struct {
+    unsigned int period;      // Period in generator ticks (chip clock/16)
+    unsigned int counter;     // Count remaining until next LFSR shift
+    unsigned int signal;      // Current signal state high or low
+    unsigned int lfsr;        // 17 bit noise shift register
+  } noise_state;
+
+  unsigned int mixed[3];      // Mix of tone & noise
+  uint8_t      level;         // Combined level, sampled into output[]
+
+  // Internal state of envelope generator
+  struct {
+    unsigned int remaining;
+    unsigned int period_counter;
+    uint8_t      envelope_value;
+  } envelope_state;
+} ay3ref_state;
+
+// Create an instance of reference AY-3-8913
+// Params: cfg - configuration, or NULL for defaults
+// Returns a reference AY3 handle
+ay3ref_state *create_ay3ref(const ay3_config *cfg);
+
+// Destroy an instance of reference AY-3-8913
+// Params: h - reference AY3 handle
+void destroy_ay3ref(ay3ref_state *h);
+
+// Called on every clock
+// Params: h - reference AY3 handle
+//         via - VIA handle of connected VIA
+void ay3ref_clk(ay3ref_state *h, via_state *via);
+
+// Print the complete internal state, for debugging
+// Params: h - reference AY3 handle
+//         f - stream to print to
+void ay3ref_dump(ay3ref_state *h, FILE *f);
+
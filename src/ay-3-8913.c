@@ -8,37 +8,159 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 // Prototypes for private functions
 static void ay3_reset(ay3_state *h);
+static uint16_t ay3_period(unsigned int period);
 static void ay3_set_register(ay3_state *h, unsigned int reg, uint8_t val);
 static uint8_t ay3_get_register(ay3_state *h, unsigned int reg);
 static void ay3_process(ay3_state *h);
+static void ay3_block_done(ay3_state *h);
+static void ay3_tick_ay(ay3_state *h);
+static void ay3_tick_ym(ay3_state *h);
 static void ay3_gen_noise(ay3_state *h);
 static void ay3_gen_tone(ay3_state *h);
-static void ay3_mix(ay3_state *h);
+static inline void ay3_mix_ampl(ay3_state *h, unsigned int steps, unsigned int scale);
 static void reset_envelope_generator(ay3_state *h);
-static uint8_t envelope_generator(ay3_state *h);
-static void ay3_envelope_ampl(ay3_state *h);
-static void ay3_combine(ay3_state *h);
-
+static inline uint8_t envelope_generator(ay3_state *h, unsigned int steps);
+
+// Implemented bits of each register. Unused bits read back as zero on the
+// GI parts, whereas the YM2149 implements all eight bits of every register.
+static const uint8_t ay38910_reg_mask[16] = {
+  0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+  0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0xff
+};
+static const uint8_t ay38912_reg_mask[16] = {
+  0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+  0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0x00
+};
+static const uint8_t ay38913_reg_mask[16] = {
+  0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+  0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0x00, 0x00
+};
+static const uint8_t ym2149_reg_mask[16] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+// Keep the per-clock working set within two cache lines
+_Static_assert(sizeof(ay3_hot) <= 2 * AY3_CACHE_LINE, "ay3_hot has outgrown two cache lines");
+
+
+void ay3_default_config(ay3_config *cfg) {
+  cfg->variant     = AY3_VARIANT_AY38913;
+  cfg->samples     = AY3_DEFAULT_SAMPLES;
+  cfg->clockspeed  = AY3_DEFAULT_CLOCKSPEED;
+  cfg->chipclock   = AY3_DEFAULT_CLOCKSPEED;
+  cfg->samplerate  = AY3_DEFAULT_SAMPLERATE;
+  cfg->ym_sel_div2 = false;
+  cfg->trace       = true;
+}
 
-ay3_state *create_ay3() {
-  ay3_state *h = malloc(sizeof(ay3_state));
+ay3_state *create_ay3(const ay3_config *cfg, arena *mem) {
+  // malloc() only guarantees 16 byte alignment. The size of ay3_state is a
+  // multiple of the cache line, as aligned_alloc() requires.
+  ay3_state *h = aligned_alloc(AY3_CACHE_LINE, sizeof(ay3_state));
   if (!h) {
     printf("Alloc fail!");
     exit(999);
   }
+  if (cfg) {
+    h->cold.cfg = *cfg;
+  } else {
+    ay3_default_config(&h->cold.cfg);
+  }
+  cfg = &h->cold.cfg;
+
+  // Tone and noise generators tick every 16 chip clocks (32 if the YM2149
+  // SEL pin halves the master clock). Neither the generators nor the output
+  // may run faster than ay3_clk() is called.
+  uint64_t divider = 16;
+  if ((cfg->variant == AY3_VARIANT_YM2149) && cfg->ym_sel_div2) {
+    divider = 32;
+  }
+  if ((cfg->samples == 0) ||
+      (cfg->clockspeed == 0) ||
+      (cfg->chipclock > divider * cfg->clockspeed) ||
+      (cfg->samplerate > cfg->clockspeed)) {
+    printf("AY3: Bad config!");
+    exit(999);
+  }
+  // Round to nearest, so that an integer sample rate such as 63781Hz
+  // (1020500/16 = 63781.25Hz) still gives exactly one sample per tick
+  h->hot.tone_step   = (((uint64_t)cfg->chipclock << AY3_FIXED_SHIFT) +
+                        divider * cfg->clockspeed / 2) /
+                       (divider * cfg->clockspeed);
+  h->hot.sample_step = (((uint64_t)cfg->samplerate << AY3_FIXED_SHIFT) +
+                        cfg->clockspeed / 2) /
+                       cfg->clockspeed;
+  // Rates too low to register at all would never produce any output
+  if ((h->hot.tone_step == 0) || (h->hot.sample_step == 0)) {
+    printf("AY3: Bad config!");
+    exit(999);
+  }
+
+  switch (cfg->variant) {
+    case AY3_VARIANT_AY38910:
+      h->cold.reg_mask = ay38910_reg_mask;
+      h->hot.tick      = ay3_tick_ay;
+      break;
+    case AY3_VARIANT_AY38912:
+      h->cold.reg_mask = ay38912_reg_mask;
+      h->hot.tick      = ay3_tick_ay;
+      break;
+    case AY3_VARIANT_YM2149:
+      h->cold.reg_mask = ym2149_reg_mask;
+      h->hot.tick      = ay3_tick_ym;
+      break;
+    default:
+      h->cold.reg_mask = ay38913_reg_mask;
+      h->hot.tick      = ay3_tick_ay;
+      break;
+  }
+
+  h->hot.samples = cfg->samples;
+  if (mem) {
+    h->hot.output = arena_alloc(mem, cfg->samples, 4);
+    h->cold.output_owned = false;
+  } else {
+    h->hot.output = malloc(cfg->samples);
+    h->cold.output_owned = true;
+  }
+  if (!h->hot.output) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  h->cold.own_output = h->hot.output;
+  h->cold.completed  = h->hot.output;
+  h->cold.block_fn   = NULL;
+  h->cold.block_ctx  = NULL;
+
+  // Registers start out zeroed, so derive the cached mixer, amplitude and
+  // envelope state from that
   for (unsigned int i = 0; i < 16; ++i) {
-    h->regs[i] = 0;
+    h->cold.regs[i] = 0;
   }
-  srand(time(NULL));
+  h->hot.tone_en   = 0x07;
+  h->hot.noise_en  = 0x07;
+  h->hot.env_mode  = 0;
+  h->hot.gain[0]   = h->hot.gain[1] = h->hot.gain[2] = 0;
+  h->hot.env_period = 0;
+  h->hot.env_shape  = 0;
+  h->hot.blocks = 0;
+  h->hot.clocks = 0;
+  h->hot.samples_out = 0;
+  h->cold.reg_writes = 0;
+  h->cold.reg_reads = 0;
+  h->cold.latches = 0;
   ay3_reset(h);
   return h;
 }
 
 void destroy_ay3(ay3_state *h) {
+  if (h->cold.output_owned) {
+    free(h->cold.own_output);
+  }
   free(h);
 }
 
@@ -52,9 +174,11 @@ void ay3_clk(ay3_state *h, via_state *via) {
   //  PB1 -> BDIR
   //  PB2 -> RESET'
   //  (other bits unused)
-  uint8_t bc1   = via->port_b & 0x01;
-  uint8_t bdir  = via->port_b & 0x02;
-  uint8_t reset = via->port_b & 0x04;
+  uint8_t bc1   = via->hot.port_b & 0x01;
+  uint8_t bdir  = via->hot.port_b & 0x02;
+  uint8_t reset = via->hot.port_b & 0x04;
+
+  ++h->hot.clocks;
 
   //printf("ay3_clk: bc1=%x bdir=%x reset=%x\n", bc1, bdir, reset);
   if (reset == 0) {
@@ -71,65 +195,167 @@ void ay3_clk(ay3_state *h, via_state *via) {
   //  1    1     Latch register address
   if ((bdir == 0) && (bc1 != 0)) {
     // Read register
-    via->port_a = ay3_get_register(h, h->selected);
+    via->hot.port_a = ay3_get_register(h, h->cold.selected);
+    ++h->cold.reg_reads;
   } else if ((bdir != 0) && (bc1 == 0)) {
     // Write register
-    ay3_set_register(h, h->selected, via->port_a);
+    ay3_set_register(h, h->cold.selected, via->hot.port_a);
+    ++h->cold.reg_writes;
   } else if ((bdir != 0) && (bc1 != 0)) {
     // Latch register
-    printf("AY3: Latching R%d\n", via->port_a);
-    h->selected = via->port_a;
+    if (h->cold.cfg.trace) {
+      printf("AY3: Latching R%d\n", via->hot.port_a);
+    }
+    h->cold.selected = via->hot.port_a;
+    ++h->cold.latches;
   }
 
   // Generate signal
   ay3_process(h);
 }
 
+void ay3_set_block_sink(ay3_state *h, ay3_block_fn fn, void *ctx) {
+  if (h->cold.block_fn) {
+    // Pass on whatever has been written so far
+    h->cold.block_fn(h->cold.block_ctx, h->hot.output, h->hot.idx, true);
+    h->hot.output = h->cold.own_output;
+    h->cold.completed = h->cold.own_output;
+    h->hot.idx = 0;
+  }
+  h->cold.block_fn  = fn;
+  h->cold.block_ctx = ctx;
+  if (fn) {
+    uint8_t *next = fn(ctx, NULL, 0, false);
+    if (next) {
+      h->hot.output = next;
+    }
+    h->hot.idx = 0;
+  }
+}
+
+void ay3_get_stats(ay3_state *h, ay3_stats *s) {
+  s->clocks     = h->hot.clocks;
+  s->samples    = h->hot.samples_out;
+  s->reg_writes = h->cold.reg_writes;
+  s->reg_reads  = h->cold.reg_reads;
+  s->latches    = h->cold.latches;
+}
+
+void ay3_dump(ay3_state *h, FILE *f) {
+  ay3_hot *hot = &h->hot;
+  fprintf(f, "  regs:");
+  for (unsigned int i = 0; i < 16; ++i) {
+    fprintf(f, " %02x", h->cold.regs[i]);
+  }
+  fprintf(f, "  selected: R%d\n", h->cold.selected);
+  fprintf(f, "  tone_phase: 0x%05x/0x%05x  sample_phase: 0x%05x/0x%05x\n",
+          hot->tone_phase, hot->tone_step, hot->sample_phase, hot->sample_step);
+  fprintf(f, "  idx: %u/%u  blocks: %u  level: %u\n",
+          hot->idx, hot->samples, hot->blocks, hot->level);
+  for (unsigned int ch = 0; ch < 3; ++ch) {
+    fprintf(f, "  tone %c: period %u counter %u signal %u tone_en %u noise_en %u env %u gain %u\n",
+            'A' + ch, hot->tone_period[ch], hot->tone_counter[ch],
+            (hot->signal >> ch) & 0x01, (hot->tone_en >> ch) & 0x01,
+            (hot->noise_en >> ch) & 0x01, (hot->env_mode >> ch) & 0x01, hot->gain[ch]);
+  }
+  fprintf(f, "  noise: period %u counter %u signal %u lfsr 0x%05x\n",
+          hot->noise_period, hot->noise_counter, (hot->signal >> 3) & 0x01, hot->noise_lfsr);
+  fprintf(f, "  envelope: period %u shape 0x%x remaining %u period_counter %u value %u divider %u\n",
+          hot->env_period, hot->env_shape, hot->env_remaining,
+          hot->env_period_counter, hot->env_value, hot->env_divider);
+}
+
 static void ay3_reset(ay3_state *h) {
-  printf("AY3: reset\n");
-  h->selected = 0;
-  h->idx = 0;
+  if (h->cold.cfg.trace) {
+    printf("AY3: reset\n");
+  }
+  h->cold.selected = 0;
+  h->hot.idx = 0;
+  h->hot.tone_phase = 0;
+  h->hot.sample_phase = 0;
+  h->hot.env_divider = 16;
+  h->hot.level = 0;
   for (unsigned int ch = 0; ch < 3; ++ch) {
-    h->tone_state.period[ch]  = 4095;
-    h->tone_state.counter[ch] = 1;
-    h->tone_state.signal[ch]  = 0;
+    h->hot.tone_period[ch]  = 4095;
+    h->hot.tone_counter[ch] = 1;
   }
-  h->noise_state.period  = 31;
-  h->noise_state.counter = 1;
-  h->noise_state.signal  = 0;
-  memset(h->output, 0, AY3_SAMPLES);
+  h->hot.noise_period  = 31;
+  h->hot.noise_counter = 1;
+  h->hot.noise_lfsr = 1;
+  h->hot.signal = 0;
+  memset(h->hot.output, 0, h->hot.samples);
   reset_envelope_generator(h);
 }
 
+// Tone and noise period registers of zero behave as one, as on the real
+// chip (and so that the counters can never wrap)
+static uint16_t ay3_period(unsigned int period) {
+  return (period == 0) ? 1 : period;
+}
+
 static void ay3_set_register(ay3_state *h, unsigned int reg, uint8_t val) {
-  printf("AY3: Setting R%d to 0x%x\n", reg, val);
-  h->regs[reg] = val;
+  if (h->cold.cfg.trace) {
+    printf("AY3: Setting R%d to 0x%x\n", reg, val);
+  }
+  if (reg > 15) {
+    // Not decoded by the chip
+    return;
+  }
+  uint8_t *regs = h->cold.regs;
+  regs[reg] = val & h->cold.reg_mask[reg];
   switch (reg) {
     case 0:
     case 1:
       // Changing period on channel A - calculate the updated period
       // and reset tone generator state
-      h->tone_state.period[0] = h->regs[0] + ((h->regs[1] & 0x0f) << 8);
-      h->tone_state.counter[0] = h->tone_state.period[0];
+      h->hot.tone_period[0] = ay3_period(regs[0] + ((regs[1] & 0x0f) << 8));
+      h->hot.tone_counter[0] = h->hot.tone_period[0];
       break;
     case 2:
     case 3:
       // Changing period on channel B - calculate the updated period
       // and reset tone generator state
-      h->tone_state.period[1] = h->regs[2] + ((h->regs[3] & 0x0f) << 8);
-      h->tone_state.counter[1] = h->tone_state.period[1];
+      h->hot.tone_period[1] = ay3_period(regs[2] + ((regs[3] & 0x0f) << 8));
+      h->hot.tone_counter[1] = h->hot.tone_period[1];
       break;
     case 4:
     case 5:
       // Changing period on channel C - calculate the updated period
       // and reset tone generator state
-      h->tone_state.period[2] = h->regs[4] + ((h->regs[5] & 0x0f) << 8);
-      h->tone_state.counter[2] = h->tone_state.period[2];
+      h->hot.tone_period[2] = ay3_period(regs[4] + ((regs[5] & 0x0f) << 8));
+      h->hot.tone_counter[2] = h->hot.tone_period[2];
       break;
     case 6:
       // Changing period on noise generator - calculate the updated period
-      h->noise_state.period = h->regs[6] & 0x1f;
-      h->noise_state.counter = h->noise_state.period;
+      h->hot.noise_period = ay3_period(regs[6] & 0x1f);
+      h->hot.noise_counter = h->hot.noise_period;
+      break;
+    case 7:
+      // Mixer enables are active low
+      h->hot.tone_en  = ~regs[7] & 0x07;
+      h->hot.noise_en = (~regs[7] >> 3) & 0x07;
+      break;
+    case 8:
+    case 9:
+    case 10:
+      // Amplitude mode (bit 4 set for envelope) and fixed amplitude 0..15.
+      // The YM2149 maps fixed amplitude N onto its 5 bit DAC as 2N+1.
+      if (regs[reg] & 0x10) {
+        h->hot.env_mode |= 1 << (reg - 8);
+      } else {
+        h->hot.env_mode &= ~(1 << (reg - 8));
+      }
+      h->hot.gain[reg - 8] = regs[reg] & 0x0f;
+      if ((h->cold.cfg.variant == AY3_VARIANT_YM2149) && (h->hot.gain[reg - 8] != 0)) {
+        h->hot.gain[reg - 8] = h->hot.gain[reg - 8] * 2 + 1;
+      }
+      break;
+    case 11:
+    case 12:
+      h->hot.env_period = regs[11] + (regs[12] << 8);
+      break;
+    case 13:
+      h->hot.env_shape = regs[13] & 0x0f;
       break;
     case 15:
       // Write to R15 (Envelope Shape/Cycle) resets the envelope generator
@@ -139,69 +365,101 @@ static void ay3_set_register(ay3_state *h, unsigned int reg, uint8_t val) {
 }
 
 static uint8_t ay3_get_register(ay3_state *h, unsigned int reg) {
-  return h->regs[reg];
+  if (reg > 15) {
+    // Not decoded by the chip
+    return 0;
+  }
+  return h->cold.regs[reg];
 }
 
 static void ay3_process(ay3_state *h) {
-  static unsigned int clkcounter = 0;
-
-  // Tone and noise is generated every 16 clocks
-  if ((++clkcounter % 16) == 0) {
-    ay3_gen_tone(h);
-    ay3_gen_noise(h);
-    ay3_mix(h);
-    ay3_envelope_ampl(h);
-    ay3_combine(h);
-    clkcounter = 0;
+  ay3_hot *hot = &h->hot;
+
+  // Tone and noise is generated every 16 chip clocks
+  hot->tone_phase += hot->tone_step;
+  if (hot->tone_phase >= AY3_FIXED_ONE) {
+    hot->tone_phase -= AY3_FIXED_ONE;
+    hot->tick(h);
+  }
+
+  // Output the combined signal to output[] at the configured sample rate
+  hot->sample_phase += hot->sample_step;
+  if (hot->sample_phase >= AY3_FIXED_ONE) {
+    hot->sample_phase -= AY3_FIXED_ONE;
+    hot->output[hot->idx++] = hot->level;
+    ++hot->samples_out;
+    if (hot->idx >= hot->samples) {
+      hot->idx = 0;
+      ++hot->blocks;
+      ay3_block_done(h);
+    }
+  }
+}
+
+// Called when the output buffer has filled. Hand it to the sink, if any,
+// and get the next one.
+static void ay3_block_done(ay3_state *h) {
+  h->cold.completed = h->hot.output;
+  if (h->cold.block_fn) {
+    uint8_t *next = h->cold.block_fn(h->cold.block_ctx, h->hot.output, h->hot.samples, false);
+    if (next) {
+      h->hot.output = next;
+    }
   }
 }
 
+// Generator tick for the GI parts: 16 step envelope, 4 bit DAC
+static void ay3_tick_ay(ay3_state *h) {
+  ay3_gen_tone(h);
+  ay3_gen_noise(h);
+  ay3_mix_ampl(h, 16, 10);
+}
+
+// Generator tick for the YM2149: 32 step envelope, 5 bit DAC
+static void ay3_tick_ym(ay3_state *h) {
+  ay3_gen_tone(h);
+  ay3_gen_noise(h);
+  ay3_mix_ampl(h, 32, 5);
+}
+
 // Three-channel squarewave generator, called every 16th clock
 static void ay3_gen_tone(ay3_state *h) {
 
   for (unsigned int ch = 0; ch < 3; ++ch) {
-    if (--h->tone_state.counter[ch] == 0) {
-      h->tone_state.counter[ch] = h->tone_state.period[ch];
-      h->tone_state.signal[ch] = ((h->tone_state.signal[ch] == 0) ? 1 : 0);
+    if (--h->hot.tone_counter[ch] == 0) {
+      h->hot.tone_counter[ch] = h->hot.tone_period[ch];
+      h->hot.signal ^= 1 << ch;
     }
   }
 }
 
 // Single channel PRNG noise generator, called every 16th clock
+// 17 bit LFSR with taps at bits 0 and 3, as on the real chip
 static void ay3_gen_noise(ay3_state *h) {
-  if (--h->noise_state.counter == 0) {
-    h->noise_state.counter = h->noise_state.period;
-    h->noise_state.signal = rand() & 0x01;
-  }
-}
-
-// Mix the three tone channels plus noise, called every 16th clock
-static void ay3_mix(ay3_state *h) {
-
-  unsigned int en = h->regs[7];
-  unsigned int tone_en[]  = {(en & 0x01) >> 0, (en & 0x02) >> 1, (en & 0x04) >> 2};
-  unsigned int noise_en[] = {(en & 0x08) >> 3, (en & 0x10) >> 4, (en & 0x20) >> 5};
-
-  for (unsigned int ch = 0; ch < 3; ++ch) {
-    unsigned int t_en = (tone_en[ch]  == 0 ? 1 : 0);
-    unsigned int n_en = (noise_en[ch] == 0 ? 1 : 0);
-    h->mixed[ch] = t_en * h->tone_state.signal[ch] + n_en * h->noise_state.signal;
+  if (--h->hot.noise_counter == 0) {
+    h->hot.noise_counter = h->hot.noise_period;
+    uint32_t lfsr = h->hot.noise_lfsr;
+    lfsr = (lfsr >> 1) | (((lfsr ^ (lfsr >> 3)) & 0x01) << 16);
+    h->hot.noise_lfsr = lfsr;
+    h->hot.signal = (h->hot.signal & 0x07) | ((lfsr & 0x01) << 3);
   }
 }
 
 // Reset envelope generator state
 static void reset_envelope_generator(ay3_state *h) {
-  h->envelope_state.envelope_value = 0;
-  h->envelope_state.remaining = 1;
-  h->envelope_state.period_counter = 0;
+  h->hot.env_value = 0;
+  h->hot.env_remaining = 1;
+  h->hot.env_period_counter = 0;
 }
 
 // Generate amplitude envelope, called every 1/256th clock
-static uint8_t envelope_generator(ay3_state *h) {
+// Params: h - AY3 handle
+//         steps - envelope resolution, 16 (GI) or 32 (YM2149)
+static inline uint8_t envelope_generator(ay3_state *h, unsigned int steps) {
 
-  // Period of envelope in terms of cycles of (CLOCKSPEED/256)
-  unsigned int period = h->regs[11] + (h->regs[12] << 8);
-  unsigned int shape  = h->regs[13] & 0x0f;
+  // Period of envelope in terms of cycles of (chip clock/256)
+  unsigned int period = h->hot.env_period;
+  unsigned int shape  = h->hot.env_shape;
 
   // Decode the shape
   unsigned int env_continue  = (shape & 0x08) >> 3;
@@ -209,18 +467,19 @@ static uint8_t envelope_generator(ay3_state *h) {
   unsigned int env_alternate = (shape & 0x02) >> 1;
   unsigned int env_hold      = (shape & 0x01);
 
-  if (--h->envelope_state.remaining == 0) {
-    h->envelope_state.remaining = period + 1;
-    ++h->envelope_state.period_counter;
+  if (--h->hot.env_remaining == 0) {
+    h->hot.env_remaining = period + 1;
+    ++h->hot.env_period_counter;
   }
 
-  // Divide the period up into 16 segments
-  unsigned int step = (period + 1 - h->envelope_state.remaining) * 16 / (period + 1);
+  // Divide the period up into 16 (or 32) segments
+  unsigned int step = (period + 1 - h->hot.env_remaining) * steps / (period + 1);
+  unsigned int top  = steps - 1;
 
-  if (h->envelope_state.period_counter == 1) {
+  if (h->hot.env_period_counter == 1) {
     // Within the first period, the only param that matters is the attack
     // which has the effect of inverting the signal
-    return (env_attack ? step : 15 - step);
+    return (env_attack ? step : top - step);
   } else {
     // For subsequent periods 2, 3, 4 ...
     if (!env_continue) {
@@ -232,57 +491,42 @@ static uint8_t envelope_generator(ay3_state *h) {
       if (env_hold) {
         // Holding ...
         // Value goes high if either attack is true or alternate mode is set, but not both
-        return (env_alternate ^ env_attack) * 15;
+        return (env_alternate ^ env_attack) * top;
       } else {
         // Not holding ...
         if (!env_alternate) {
           // Not alternating, do the same thing as initial period, again and again
-          return (env_attack ? step : 15 - step);
+          return (env_attack ? step : top - step);
         } else {
           // Alternating, do the opposite thing each time
-          return (((h->envelope_state.period_counter % 2 == 0) ^ env_attack) ? step : 15 - step);
+          return (((h->hot.env_period_counter % 2 == 0) ^ env_attack) ? step : top - step);
         }
       }
     }
   }
 }
 
-// Scale by fixed amplitude or apply envelope, called every 1/16th clock
-static void ay3_envelope_ampl(ay3_state *h) {
-  static unsigned int callcounter = 0;
-
-  // Amplitude mode (0 for fixed, 1 for envelope)
-  unsigned int mode[] = {(h->regs[8]  & 0x10) >> 4,
-                         (h->regs[9]  & 0x10) >> 4,
-                         (h->regs[10] & 0x10) >> 4};
-
-  // Fixed amplitude in range 0..15
-  unsigned int ampl[] = {h->regs[8]  & 0x0f,
-                         h->regs[9]  & 0x0f,
-                         h->regs[10] & 0x0f};
+// Mix the three tone channels plus noise, scale by fixed amplitude or
+// apply envelope, and combine. Called every 1/16th clock.
+// Params: h - AY3 handle
+//         steps - envelope resolution, 16 (GI) or 32 (YM2149)
+//         scale - output scale for the DAC range
+static inline void ay3_mix_ampl(ay3_state *h, unsigned int steps, unsigned int scale) {
+  ay3_hot *hot = &h->hot;
 
   // Every 16 calls, update the envelope (16*16 = every 256 clks)
-  if ((++callcounter % 16) == 0) {
-    h->envelope_state.envelope_value = envelope_generator(h);
-    callcounter = 0;
+  if (--hot->env_divider == 0) {
+    hot->env_value = envelope_generator(h, steps);
+    hot->env_divider = 16;
   }
 
+  unsigned int noise = (hot->signal >> 3) & 0x01;
+  unsigned int sum = 0;
   for (unsigned int ch = 0; ch < 3; ++ch) {
-    if (mode[ch] == 0) {
-      h->mixed[ch] *= ampl[ch];
-    } else {
-      h->mixed[ch] *= h->envelope_state.envelope_value;
-    }
-  }
-}
-
-// Output the combined signal to output[], called every 1/16th clock
-static void ay3_combine(ay3_state *h) {
-  h->output[h->idx++] = (h->mixed[0] + h->mixed[1] + h->mixed[2]) * 10;
-  if (h->idx >= AY3_SAMPLES) {
-    h->idx = 0;
+    unsigned int mixed = ((hot->tone_en  >> ch) & (hot->signal >> ch) & 0x01) +
+                         ((hot->noise_en >> ch) & noise);
+    unsigned int gain  = ((hot->env_mode >> ch) & 0x01) ? hot->env_value : hot->gain[ch];
+    sum += mixed * gain;
   }
+  hot->level = sum * scale;
 }
-
-
-
@@ -7,56 +7,160 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include "wdc6522.h"
+#include "arena.h"
 
-#define AY3_SAMPLES 4096           // Number of samples to buffer
-#define CLOCKSPEED 1020500         // Host CPU clock
-#define AY3_SAMPLERATE (CLOCKSPEED/16)
+// Default configuration, used when create_ay3() is passed NULL
+#define AY3_DEFAULT_SAMPLES    4096      // Number of samples to buffer
+#define AY3_DEFAULT_CLOCKSPEED 1020500   // Host CPU clock (NTSC Apple II)
+#define AY3_DEFAULT_SAMPLERATE (AY3_DEFAULT_CLOCKSPEED/16)
 
 //
-// We generate a sample of output every 16 clocks
-// 1020500/16 -> 63.78kHz ouput
+// With the default configuration we generate a sample of output every 16
+// clocks: 1020500/16 -> 63.78kHz ouput
 // If we drop every 4th sample -> 47.84kHz which is very close to 48kHz
 //
+// Other host clocks (eg: PAL Apple IIe at 1015625Hz, accelerator cards) and
+// output sample rates are handled with 16.16 fixed-point phase accumulators,
+// the increments for which are computed once in create_ay3().
+//
 
-// State of AY-3-8913
+#define AY3_FIXED_SHIFT 16
+#define AY3_FIXED_ONE   (1u << AY3_FIXED_SHIFT)
+
+#define AY3_CACHE_LINE  64
+
+// Chip variants
+typedef enum {
+  AY3_VARIANT_AY38910,  // GI AY-3-8910: two I/O ports (R14, R15)
+  AY3_VARIANT_AY38912,  // GI AY-3-8912: one I/O port (R14)
+  AY3_VARIANT_AY38913,  // GI AY-3-8913: no I/O ports (as on Mockingboard)
+  AY3_VARIANT_YM2149    // Yamaha YM2149: 32 step envelope, 5 bit DAC
+} ay3_variant;
+
+// Configuration of AY-3-8913
+typedef struct {
+  ay3_variant  variant;
+  unsigned int samples;       // Number of samples to buffer
+  uint32_t     clockspeed;    // Rate at which ay3_clk() is called (Hz)
+  uint32_t     chipclock;     // Master clock of the sound chip (Hz)
+  uint32_t     samplerate;    // Output sample rate (Hz)
+  bool         ym_sel_div2;   // YM2149 only: SEL pin low, halve master clock
+  bool         trace;         // Log register accesses to stdout
+} ay3_config;
+
+typedef struct ay3_state ay3_state;
+
+// Block sink, called from ay3_clk() each time the output buffer fills.
+// Params: ctx - context passed to ay3_set_block_sink()
+//         block - the completed block, or NULL to request the first buffer
+//         samples - number of samples in block
+//         last - true when the sink is being detached, in which case block
+//                is the partly filled final block and no buffer is wanted
+// Returns the buffer to fill next, which may be block itself, or NULL to
+// carry on with the current buffer. It must hold at least cfg.samples
+// samples. Ignored when last is true.
+typedef uint8_t *(*ay3_block_fn)(void *ctx, uint8_t *block, uint32_t samples, bool last);
+
+//
+// The state is split by how often it is touched. The hot part is everything
+// ay3_clk() reads or writes on every clock and generator tick, packed with
+// right-sized types so that it fits in two 64 byte cache lines (104 bytes of
+// fields on a 64-bit host, less with the RP2040's 32-bit pointers). It is
+// aligned to a cache line, so that it never straddles a third one. The cold
+// part is only touched on register accesses. The output buffer is allocated
+// separately, optionally from a caller-provided arena.
+//
+
+// Hot state of AY-3-8913, ordered by frequency of access
+typedef struct {
+  // Fixed-point phase accumulators (16.16), touched every clock
+  _Alignas(AY3_CACHE_LINE) uint32_t tone_phase;
+  uint32_t tone_step;       // Generator ticks per ay3_clk()
+  uint32_t sample_phase;
+  uint32_t sample_step;     // Output samples per ay3_clk()
+
+  // Output buffer, touched every sample
+  uint8_t  *output;         // Buffer of samples entries
+  uint32_t idx;             // Write index into output buffer
+  uint32_t samples;         // Number of samples in output buffer
+  uint32_t blocks;          // Number of times output[] has been filled
+
+  // Statistics
+  uint64_t clocks;          // Clocks emulated
+  uint64_t samples_out;     // Samples produced
+
+  // Variant specific code path, selected in create_ay3()
+  void (*tick)(ay3_state *h);  // Called every 16 chip clocks
+
+  // Envelope generator
+  uint32_t env_remaining;      // Count remaining in current period
+  uint32_t env_period_counter; // Number of periods started
+  uint32_t noise_lfsr;         // 17 bit noise shift register
+  uint16_t env_period;         // From R11/R12
+  uint8_t  env_shape;          // From R13
+  uint8_t  env_value;          // Current envelope amplitude
+  uint8_t  env_divider;        // Generator ticks until next envelope update
+
+  // Tone and noise generators, periods in generator ticks (chip clock/16)
+  uint16_t tone_period[3];
+  uint16_t tone_counter[3];    // Count remaining until flip
+  uint8_t  noise_period;
+  uint8_t  noise_counter;      // Count remaining until next LFSR shift
+  uint8_t  signal;             // Bits 0-2 tone A-C, bit 3 noise
+
+  // Mixer and amplitude control, cached from R7-R10 when written
+  uint8_t  tone_en;            // Bit per channel, set if tone enabled
+  uint8_t  noise_en;           // Bit per channel, set if noise enabled
+  uint8_t  env_mode;           // Bit per channel, set if using envelope
+  uint8_t  gain[3];            // Fixed amplitude, mapped to the DAC range
+  uint8_t  level;              // Combined level, sampled into output[]
+} ay3_hot;
+
+// Cold state of AY-3-8913, touched only by register accesses
 typedef struct {
   uint8_t regs[16];
-  uint8_t selected; // Selected register
-
-  // Output buffer
-  uint8_t output[AY3_SAMPLES];
-
-  // Write index into output buffers
-  unsigned int idx;
-
-  // Interal state of tone generator
-  struct {
-    unsigned int period[3];   // Period in terms of CLOCKSPEED/16
-    unsigned int counter[3];  // Count remaining until flip
-    unsigned int signal[3];   // Current signal state high or low
-  } tone_state;
-
-  // Interal state of noise generator
-  struct {
-    unsigned int period;      // Period in terms of CLOCKSPEED/16
-    unsigned int counter;     // Count remaining until next random value
-    unsigned int signal;      // Current signal state high or low
-  } noise_state;
-
-  unsigned int mixed[3];      // Mix of tone & noise
-
-  // Internal state of envelope generator
-  struct {
-    unsigned int remaining;
-    unsigned int period_counter;
-    uint8_t      envelope_value;
-  } envelope_state;
-} ay3_state;
+  uint8_t selected;            // Selected register
+  bool    output_owned;        // Own buffer was malloc()ed, not arena
+  uint8_t *own_output;         // Own buffer, used when there is no sink
+  uint8_t *completed;          // Most recently completed block
+  ay3_block_fn block_fn;       // Block sink, or NULL
+  void    *block_ctx;
+
+  // Statistics
+  uint64_t reg_writes;         // Register writes
+  uint64_t reg_reads;          // Register reads
+  uint64_t latches;            // Register address latches
+  const uint8_t *reg_mask;     // Implemented bits of each register
+  ay3_config cfg;
+} ay3_cold;
+
+// State of AY-3-8913
+struct ay3_state {
+  ay3_hot  hot;
+  ay3_cold cold;
+};
+
+// Statistics of AY-3-8913
+typedef struct {
+  uint64_t clocks;      // Clocks emulated
+  uint64_t samples;     // Samples produced
+  uint64_t reg_writes;  // Register writes
+  uint64_t reg_reads;   // Register reads
+  uint64_t latches;     // Register address latches
+} ay3_stats;
+
+// Fill in the default configuration
+// Params: cfg - configuration to initialize [OUT]
+void ay3_default_config(ay3_config *cfg);
 
 // Create an instance of AY-3-8913
+// Params: cfg - configuration, or NULL for defaults
+//         mem - arena to allocate the output buffer from, or NULL to use
+//               malloc()
 // Returns an AY3 handle
-ay3_state *create_ay3();
+ay3_state *create_ay3(const ay3_config *cfg, arena *mem);
 
 // Destroy an instance of AY-3-8913
 // Params: h - AY3 handle
@@ -67,4 +171,25 @@ void destroy_ay3(ay3_state *h);
 //         via - VIA handle of connected VIA
 void ay3_clk(ay3_state *h, via_state *via);
 
+// Attach or detach a block sink, which supplies the output buffers and
+// receives them as they fill, so that they can be consumed without
+// copying. When detaching, the partly filled block is passed to the old
+// sink with last set, and output continues in the instance's own buffer.
+// Params: h - AY3 handle
+//         fn - block sink, or NULL to detach
+//         ctx - context passed to fn
+void ay3_set_block_sink(ay3_state *h, ay3_block_fn fn, void *ctx);
+
+// Get statistics. The counters are not atomic, so when called from a
+// thread other than the one running ay3_clk() the values may be slightly
+// stale or, on 32-bit targets, torn.
+// Params: h - AY3 handle
+//         s - statistics [OUT]
+void ay3_get_stats(ay3_state *h, ay3_stats *s);
+
+// Print the complete internal state, for debugging
+// Params: h - AY3 handle
+//         f - stream to print to
+void ay3_dump(ay3_state *h, FILE *f);
+
 
@@ -0,0 +1,189 @@
+//
+// Benchmark of Mockingboard emulation
+//
+// Renders audio as fast as possible, without PulseAudio, and reports the
+// emulation speed relative to realtime along with the size of the state
+// structures (which matters on the RP2040 with its 264KB of SRAM). As on
+// a real Mockingboard there are two VIA and AY3 pairs. The second pass adds
+// an SSI-263 speaking continuously on the first VIA's CA1, to show what
+// speech costs on top of them. Stage timings cover both pairs, apart from
+// the block stage, which is the speech mixed into the first pair's output.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ay-3-8913.h"
+#include "ssi263.h"
+#include "stats.h"
+
+#define BENCH_SECONDS 10
+#define BENCH_PAIRS   2   // VIA and AY3 pairs
+
+static _Alignas(8) uint8_t audio_mem[BENCH_PAIRS * AY3_DEFAULT_SAMPLES + sizeof(ssi263_tables)];
+
+// Phonemes spoken over and over in the second pass: "hello"
+static const uint8_t phrase[] = {0x2a, 0x0a, 0x20, 0x11, 0x13, 0x00};
+
+// Write a value to an AY3 register via the VIA
+static void bench_write_reg(via_state *via, ay3_state *ay3, uint8_t reg, uint8_t val) {
+  //           cs1   cs2b   rwb   rs          data
+  via_clk(via, true, false, true, VIAREG_ORB, 0b100); // AY3 inactive
+  ay3_clk(ay3, via);
+  via_clk(via, true, false, true, VIAREG_ORA, reg);   // Register number
+  ay3_clk(ay3, via);
+  via_clk(via, true, false, true, VIAREG_ORB, 0b111); // Latch register
+  ay3_clk(ay3, via);
+  via_clk(via, true, false, true, VIAREG_ORB, 0b100); // AY3 inactive
+  ay3_clk(ay3, via);
+  via_clk(via, true, false, true, VIAREG_ORA, val);   // Register data
+  ay3_clk(ay3, via);
+  via_clk(via, true, false, true, VIAREG_ORB, 0b110); // Write register
+  ay3_clk(ay3, via);
+}
+
+// Put the SSI-263 through the usual driver setup, and start it speaking.
+// It will then request each phoneme through CA1.
+static void bench_ssi_start(via_state *via, ssi263_state *ssi) {
+  via_clk(via, true, false, true, VIAREG_PCR, 0x00);  // CA1 on negative edge
+  via_clk(via, true, false, true, VIAREG_IER, 0x82);  // Enable CA1 interrupt
+  //           via  cs    rs               data
+  ssi263_clk(ssi, via, true, SSIREG_CTLAMP,  0x80);   // Standby
+  ssi263_clk(ssi, via, true, SSIREG_DURPHON, 0x00);   // A/R' on each phoneme
+  ssi263_clk(ssi, via, true, SSIREG_INFLECT, 0x50);
+  ssi263_clk(ssi, via, true, SSIREG_RATEINF, 0xa8);
+  ssi263_clk(ssi, via, true, SSIREG_FILFREQ, SSI263_FF_NOMINAL);
+  ssi263_clk(ssi, via, true, SSIREG_CTLAMP,  0x7f);   // Articulation, amplitude
+  ssi263_clk(ssi, via, true, SSIREG_DURPHON, phrase[0]);
+}
+
+// Run for a number of clocks, sampling the stage timings
+// Params: ssi - SSI-263 to feed with phonemes through via[0], or NULL
+static void bench_run(via_state **via, ay3_state **ay3, ssi263_state *ssi,
+                      uint64_t clocks, loop_stats *stats) {
+  unsigned int next = 1;
+  for (uint64_t i = 0; i < clocks; ++i) {
+    // When the SSI-263 wants a phoneme, CA1 raises IRQ' (it is the only
+    // interrupt enabled). Read port A to acknowledge it and send the next,
+    // as the driver's interrupt handler would.
+    bool request = ssi && !via[0]->hot.irqb;
+    if (stats_sample(stats, i)) {
+      uint64_t t0 = stats_timestamp();
+      via_clk(via[0], true, false, !request, request ? VIAREG_IRA : 0, 0b100);
+      via_clk(via[1], true, false, true, 0, 0b100);
+      uint64_t t1 = stats_timestamp();
+      ay3_clk(ay3[0], via[0]);
+      ay3_clk(ay3[1], via[1]);
+      uint64_t t2 = stats_timestamp();
+      stats_stage_add(stats, STATS_STAGE_VIA, t1 - t0);
+      stats_stage_add(stats, STATS_STAGE_AY3, t2 - t1);
+      if (ssi) {
+        ssi263_clk(ssi, via[0], request, SSIREG_DURPHON, phrase[next]);
+        stats_stage_add(stats, STATS_STAGE_SSI, stats_timestamp() - t2);
+      }
+    } else {
+      //              cs1   cs2b   rwb       rs                           data
+      via_clk(via[0], true, false, !request, request ? VIAREG_IRA : 0, 0b100); // AY3 inactive
+      via_clk(via[1], true, false, true,     0,                        0b100);
+      ay3_clk(ay3[0], via[0]);
+      ay3_clk(ay3[1], via[1]);
+      if (ssi) {
+        ssi263_clk(ssi, via[0], request, SSIREG_DURPHON, phrase[next]);
+      }
+    }
+    if (request) {
+      next = (next + 1) % sizeof(phrase);
+    }
+  }
+}
+
+// Create the VIA and AY3 pairs and load the demo registers
+static void bench_setup(arena *mem, via_state **via, ay3_state **ay3) {
+  uint8_t regvals[] = {64, 0,   // Tone A period (fine, coarse)
+                       0, 1,    // Tone B period (fine, coarse)
+                       0, 4,    // Tone C period (fine, coarse)
+                       30,      // Noise period
+                       0xc0,    // Mixer enable
+                       15,      // Volume A
+                       16,      // Volume B
+                       15,      // Volume C
+                       0, 6,    // Envelope period (fine, coarse)
+                       0b1110,  // Envelope shape
+                       0,       // I/O Port A data - not used
+                       0        // I/O Port B data - not used
+                       };
+
+  for (unsigned int p = 0; p < BENCH_PAIRS; ++p) {
+    via[p] = create_via(NULL);
+    ay3[p] = create_ay3(NULL, mem);
+
+    // Set up VIA for output
+    via_clk(via[p], true, false, true, VIAREG_DDRA, 0xff);
+    via_clk(via[p], true, false, true, VIAREG_DDRB, 0xff);
+
+    for (uint8_t rs = 0; rs < 16; ++rs) {
+      bench_write_reg(via[p], ay3[p], rs, regvals[rs]);
+    }
+  }
+}
+
+// Destroy the VIA and AY3 pairs
+static void bench_teardown(via_state **via, ay3_state **ay3) {
+  for (unsigned int p = 0; p < BENCH_PAIRS; ++p) {
+    destroy_ay3(ay3[p]);
+    destroy_via(via[p]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  arena mem;
+  arena_init(&mem, audio_mem, sizeof(audio_mem));
+
+  via_state *via[BENCH_PAIRS];
+  ay3_state *ay3[BENCH_PAIRS];
+  bench_setup(&mem, via, ay3);
+
+  // Time one clock in 1024 per stage, to show where the time goes
+  uint64_t clocks = (uint64_t)BENCH_SECONDS * ay3[0]->cold.cfg.clockspeed;
+  loop_stats stats;
+  stats_init(&stats, 1023);
+  bench_run(via, ay3, NULL, clocks, &stats);
+  double elapsed = stats_elapsed(&stats);
+
+  // Again from scratch with speech, so that the statistics cover only this.
+  // No tracing, as printing each phoneme would be timed too.
+  bench_teardown(via, ay3);
+  arena_reset(&mem);
+  bench_setup(&mem, via, ay3);
+  ssi263_config ssi_cfg;
+  ssi263_default_config(&ssi_cfg);
+  ssi_cfg.trace = false;
+  ssi263_state *ssi = create_ssi263(&ssi_cfg, &mem);
+  stats_init(&stats, 1023);
+  stats_set_next_sink(&stats, ssi263_block, ssi);
+  ay3_set_block_sink(ay3[0], stats_block, &stats);
+  bench_ssi_start(via[0], ssi);
+  bench_run(via, ay3, ssi, clocks, &stats);
+  double elapsed_ssi = stats_elapsed(&stats);
+
+  fprintf(stderr, "sizeof(ay3_state) %zu bytes (hot %zu, cold %zu)\n",
+          sizeof(ay3_state), sizeof(ay3_hot), sizeof(ay3_cold));
+  fprintf(stderr, "sizeof(via_state) %zu bytes (hot %zu, cold %zu)\n",
+          sizeof(via_state), sizeof(via_hot), sizeof(via_cold));
+  fprintf(stderr, "sizeof(ssi263_state) %zu bytes (hot %zu, synth %zu, cold %zu)\n",
+          sizeof(ssi263_state), sizeof(ssi263_hot), sizeof(ssi263_synth), sizeof(ssi263_cold));
+  fprintf(stderr, "AY3 output buffers %d x %u bytes, SSI-263 tables %zu bytes (arena %zu of %zu used)\n",
+          BENCH_PAIRS, ay3[0]->hot.samples, sizeof(ssi263_tables), mem.used, mem.size);
+  fprintf(stderr, "Emulated %llu clocks (%ds) of %d AY3s in %.3fs, %.1fx realtime\n",
+          (unsigned long long)clocks, BENCH_SECONDS, BENCH_PAIRS, elapsed, BENCH_SECONDS / elapsed);
+  ssi263_stats ss;
+  ssi263_get_stats(ssi, &ss);
+  fprintf(stderr, "With speech (%llu phonemes) in %.3fs, %.1fx realtime\n",
+          (unsigned long long)ss.phonemes, elapsed_ssi, BENCH_SECONDS / elapsed_ssi);
+  stats_dump(stderr, STATS_FORMAT_TEXT, &stats, ay3[0], via[0], ssi);
+
+  ay3_set_block_sink(ay3[0], NULL, NULL);
+  destroy_ssi263(ssi);
+  bench_teardown(via, ay3);
+  return 0;
+}
@@ -0,0 +1,419 @@
+//
+// Differential conformance test of AY-3-8913 emulation
+//
+// Drives the same register write streams through the reference engine
+// (ay-3-8913-ref.c) and the optimized engine (ay-3-8913.c), each connected
+// to its own VIA, and compares them sample by sample. Streams come from a
+// built-in corpus, from corpus files given on the command line, and from
+// a seeded random generator. On the first divergence the recent bus
+// operations and full state of both engines are printed and we exit with
+// status 1.
+//
+// Usage: conformance [-s seed] [-n streams] [-c clocks] [corpus-file ...]
+//
+// Corpus files contain one operation per line, '#' starts a comment:
+//   <idle clocks> <register> <value>   Write register after idle clocks
+//   <idle clocks> read <register>      Read register after idle clocks
+//   <idle clocks> reset                Pulse RESET' after idle clocks
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ay-3-8913.h"
+#include "ay-3-8913-ref.h"
+
+#define HISTORY 16   // Number of bus operations remembered for reports
+
+// Bus operations
+typedef enum {
+  OP_WRITE,
+  OP_READ,
+  OP_RESET
+} op_kind;
+
+typedef struct {
+  uint32_t idle;   // Idle clocks before the operation
+  op_kind  kind;
+  uint8_t  reg;
+  uint8_t  val;
+} bus_op;
+
+// A pair of engines under test, each with its own VIA
+typedef struct {
+  const char   *name;
+  via_state    *via_ref;
+  via_state    *via_opt;
+  ay3ref_state *ref;
+  ay3_state    *opt;
+  uint64_t     clocks;     // Clocks run so far
+  uint64_t     samples;    // Samples compared so far
+  uint32_t     hash;       // FNV-1a of all samples so far
+  bus_op       history[HISTORY];
+  unsigned int nhistory;
+} harness;
+
+// Configurations to test
+typedef struct {
+  const char  *name;
+  ay3_variant variant;
+  uint32_t    clockspeed;
+  uint32_t    chipclock;
+  uint32_t    samplerate;
+  bool        ym_sel_div2;
+} test_config;
+
+static const test_config configs[] = {
+  {"AY-3-8913 NTSC",          AY3_VARIANT_AY38913, 1020500, 1020500, 1020500 / 16, false},
+  {"AY-3-8910 NTSC",          AY3_VARIANT_AY38910, 1020500, 1020500, 1020500 / 16, false},
+  {"AY-3-8912 NTSC",          AY3_VARIANT_AY38912, 1020500, 1020500, 1020500 / 16, false},
+  {"YM2149 NTSC",             AY3_VARIANT_YM2149,  1020500, 1020500, 1020500 / 16, false},
+  {"YM2149 2MHz SEL",         AY3_VARIANT_YM2149,  2000000, 2000000, 48000,        true},
+  {"AY-3-8913 PAL 44.1kHz",   AY3_VARIANT_AY38913, 1015625, 1015625, 44100,        false},
+  {"AY-3-8913 4MHz accel 48kHz", AY3_VARIANT_AY38913, 4000000, 1020500, 48000,     false},
+};
+
+// Song from pulse-output.c
+static const bus_op corpus_song[] = {
+  {0, OP_WRITE, 0, 64}, {0, OP_WRITE, 1, 0}, {0, OP_WRITE, 2, 0}, {0, OP_WRITE, 3, 1},
+  {0, OP_WRITE, 4, 0}, {0, OP_WRITE, 5, 4}, {0, OP_WRITE, 6, 30}, {0, OP_WRITE, 7, 0xf8},
+  {0, OP_WRITE, 8, 0}, {0, OP_WRITE, 9, 16}, {0, OP_WRITE, 10, 0}, {0, OP_WRITE, 11, 0},
+  {0, OP_WRITE, 12, 6}, {0, OP_WRITE, 13, 0b1110}, {0, OP_WRITE, 14, 0}, {0, OP_WRITE, 15, 0},
+  {2000000, OP_WRITE, 7, 0xf8},
+};
+
+// Tone plus noise on all channels, then edge cases: zero periods, maximum
+// periods, register reads and a reset part way through
+static const bus_op corpus_edges[] = {
+  {0, OP_WRITE, 7, 0x00}, {0, OP_WRITE, 6, 1}, {0, OP_WRITE, 8, 15},
+  {0, OP_WRITE, 9, 7}, {0, OP_WRITE, 10, 3}, {0, OP_WRITE, 0, 1},
+  {0, OP_WRITE, 2, 2}, {0, OP_WRITE, 4, 3},
+  {50000, OP_WRITE, 0, 0}, {0, OP_WRITE, 1, 0}, {0, OP_WRITE, 6, 0},
+  {50000, OP_WRITE, 0, 0xff}, {0, OP_WRITE, 1, 0xff}, {0, OP_WRITE, 6, 0xff},
+  {50000, OP_READ, 1, 0}, {0, OP_READ, 6, 0}, {0, OP_READ, 14, 0}, {0, OP_READ, 15, 0},
+  {0, OP_WRITE, 14, 0xa5}, {0, OP_READ, 14, 0}, {0, OP_WRITE, 15, 0x5a}, {0, OP_READ, 15, 0},
+  {0, OP_WRITE, 0x23, 0x12}, {0, OP_READ, 0x23, 0},
+  {100000, OP_RESET, 0, 0},
+  {100000, OP_WRITE, 8, 0x1f}, {0, OP_WRITE, 11, 0}, {0, OP_WRITE, 12, 0},
+  {200000, OP_WRITE, 7, 0x3f},
+};
+
+// Prototypes for private functions
+static void harness_init(harness *t, const test_config *c);
+static void harness_free(harness *t);
+static void harness_clk(harness *t, uint8_t rs, uint8_t data);
+static void harness_run(harness *t, const bus_op *op);
+static void harness_fail(harness *t, const char *what, unsigned int a, unsigned int b);
+static uint32_t xorshift32(uint32_t *state);
+static void random_op(uint32_t *rng, bus_op *op);
+static bus_op *load_corpus(const char *path, unsigned int *count);
+
+
+int main(int argc, char *argv[]) {
+  uint32_t seed = 1;
+  unsigned int nstreams = 8;
+  uint64_t clocks = 4000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:n:c:")) != -1) {
+    switch (opt) {
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        nstreams = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        clocks = strtoull(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-s seed] [-n streams] [-c clocks] [corpus-file ...]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  for (unsigned int c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c) {
+    harness t;
+
+    // Built-in corpus
+    harness_init(&t, &configs[c]);
+    for (unsigned int i = 0; i < sizeof(corpus_song) / sizeof(corpus_song[0]); ++i) {
+      harness_run(&t, &corpus_song[i]);
+    }
+    for (unsigned int i = 0; i < sizeof(corpus_edges) / sizeof(corpus_edges[0]); ++i) {
+      harness_run(&t, &corpus_edges[i]);
+    }
+    // Every envelope shape, with a short period so we see many cycles
+    for (unsigned int shape = 0; shape < 16; ++shape) {
+      bus_op ops[] = {{0, OP_WRITE, 8, 0x10}, {0, OP_WRITE, 9, 0x10}, {0, OP_WRITE, 10, 0x10},
+                      {0, OP_WRITE, 7, 0x38}, {0, OP_WRITE, 11, 3 + shape}, {0, OP_WRITE, 12, 0},
+                      {0, OP_WRITE, 13, shape}, {0, OP_WRITE, 15, 0}, {100000, OP_WRITE, 7, 0x38}};
+      for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        harness_run(&t, &ops[i]);
+      }
+    }
+    printf("%-28s corpus    %10llu samples  hash %08x\n", t.name,
+           (unsigned long long)t.samples, t.hash);
+    harness_free(&t);
+
+    // Corpus files
+    for (int f = optind; f < argc; ++f) {
+      unsigned int count;
+      bus_op *ops = load_corpus(argv[f], &count);
+      harness_init(&t, &configs[c]);
+      for (unsigned int i = 0; i < count; ++i) {
+        harness_run(&t, &ops[i]);
+      }
+      printf("%-28s %-9.9s %10llu samples  hash %08x\n", t.name, argv[f],
+             (unsigned long long)t.samples, t.hash);
+      harness_free(&t);
+      free(ops);
+    }
+
+    // Random streams
+    for (unsigned int s = 0; s < nstreams; ++s) {
+      uint32_t rng = seed + s * 0x9e3779b9u;
+      if (rng == 0) {
+        rng = 1;
+      }
+      harness_init(&t, &configs[c]);
+      while (t.clocks < clocks) {
+        bus_op op;
+        random_op(&rng, &op);
+        harness_run(&t, &op);
+      }
+      printf("%-28s seed %-4u %10llu samples  hash %08x\n", t.name, seed + s,
+             (unsigned long long)t.samples, t.hash);
+      harness_free(&t);
+    }
+  }
+
+  printf("PASS\n");
+  return 0;
+}
+
+static void harness_init(harness *t, const test_config *c) {
+  ay3_config acfg;
+  ay3_default_config(&acfg);
+  acfg.variant     = c->variant;
+  acfg.clockspeed  = c->clockspeed;
+  acfg.chipclock   = c->chipclock;
+  acfg.samplerate  = c->samplerate;
+  acfg.ym_sel_div2 = c->ym_sel_div2;
+  acfg.trace       = false;
+
+  via_config vcfg;
+  via_default_config(&vcfg);
+  vcfg.clockspeed = c->clockspeed;
+  vcfg.phi2       = c->clockspeed;
+  vcfg.trace      = false;
+
+  t->name     = c->name;
+  t->via_ref  = create_via(&vcfg);
+  t->via_opt  = create_via(&vcfg);
+  t->ref      = create_ay3ref(&acfg);
+  t->opt      = create_ay3(&acfg, NULL);
+  t->clocks   = 0;
+  t->samples  = 0;
+  t->hash     = 2166136261u;
+  t->nhistory = 0;
+
+  // Set up VIAs for output
+  via_clk(t->via_ref, true, false, true, VIAREG_DDRA, 0xff);
+  via_clk(t->via_opt, true, false, true, VIAREG_DDRA, 0xff);
+  via_clk(t->via_ref, true, false, true, VIAREG_DDRB, 0xff);
+  via_clk(t->via_opt, true, false, true, VIAREG_DDRB, 0xff);
+}
+
+static void harness_free(harness *t) {
+  destroy_ay3ref(t->ref);
+  destroy_ay3(t->opt);
+  destroy_via(t->via_ref);
+  destroy_via(t->via_opt);
+}
+
+// Run one clock of both engines, writing data to VIA register rs, and
+// compare the results
+static void harness_clk(harness *t, uint8_t rs, uint8_t data) {
+  //                cs1   cs2b   rwb   rs  data
+  via_clk(t->via_ref, true, false, true, rs, data);
+  via_clk(t->via_opt, true, false, true, rs, data);
+  ay3ref_clk(t->ref, t->via_ref);
+  ay3_clk(t->opt, t->via_opt);
+  ++t->clocks;
+
+  if (t->via_ref->hot.port_a != t->via_opt->hot.port_a) {
+    harness_fail(t, "VIA port A", t->via_ref->hot.port_a, t->via_opt->hot.port_a);
+  }
+  if (t->ref->idx != t->opt->hot.idx) {
+    harness_fail(t, "output index", t->ref->idx, t->opt->hot.idx);
+  }
+  if (t->ref->blocks != t->opt->hot.blocks) {
+    harness_fail(t, "output blocks", t->ref->blocks, t->opt->hot.blocks);
+  }
+
+  // Check the sample just written, if any
+  uint64_t produced = (uint64_t)t->ref->blocks * t->ref->cfg.samples + t->ref->idx;
+  if (produced != t->samples) {
+    unsigned int pos = (t->ref->idx == 0) ? t->ref->cfg.samples - 1 : t->ref->idx - 1;
+    uint8_t r = t->ref->output[pos];
+    uint8_t o = t->opt->hot.output[pos];
+    if (r != o) {
+      harness_fail(t, "sample", r, o);
+    }
+    t->hash = (t->hash ^ r) * 16777619u;
+    t->samples = produced;
+  }
+}
+
+// Perform a bus operation on both engines
+static void harness_run(harness *t, const bus_op *op) {
+  t->history[t->nhistory++ % HISTORY] = *op;
+
+  for (uint32_t i = 0; i < op->idle; ++i) {
+    harness_clk(t, VIAREG_ORB, 0b100);                // AY3 inactive
+  }
+  switch (op->kind) {
+    case OP_WRITE:
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      harness_clk(t, VIAREG_ORA, op->reg);            // Register number
+      harness_clk(t, VIAREG_ORB, 0b111);              // Latch register
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      harness_clk(t, VIAREG_ORA, op->val);            // Register data
+      harness_clk(t, VIAREG_ORB, 0b110);              // Write register
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      break;
+    case OP_READ:
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      harness_clk(t, VIAREG_ORA, op->reg);            // Register number
+      harness_clk(t, VIAREG_ORB, 0b111);              // Latch register
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      harness_clk(t, VIAREG_DDRA, 0x00);              // Port A input
+      harness_clk(t, VIAREG_ORB, 0b101);              // Read register
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      harness_clk(t, VIAREG_DDRA, 0xff);              // Port A output
+      break;
+    case OP_RESET:
+      for (unsigned int i = 0; i < 4; ++i) {
+        harness_clk(t, VIAREG_ORB, 0b000);            // RESET' low
+      }
+      harness_clk(t, VIAREG_ORB, 0b100);              // AY3 inactive
+      break;
+  }
+}
+
+// Report a divergence and exit
+static void harness_fail(harness *t, const char *what, unsigned int a, unsigned int b) {
+  printf("FAIL: %s: %s differs at clock %llu, sample %llu: reference %u, optimized %u\n",
+         t->name, what, (unsigned long long)t->clocks, (unsigned long long)t->samples, a, b);
+  printf("Recent bus operations (oldest first):\n");
+  unsigned int n = (t->nhistory < HISTORY) ? t->nhistory : HISTORY;
+  for (unsigned int i = t->nhistory - n; i < t->nhistory; ++i) {
+    const bus_op *op = &t->history[i % HISTORY];
+    switch (op->kind) {
+      case OP_WRITE:
+        printf("  idle %u, write R%d = 0x%02x\n", op->idle, op->reg, op->val);
+        break;
+      case OP_READ:
+        printf("  idle %u, read R%d\n", op->idle, op->reg);
+        break;
+      case OP_RESET:
+        printf("  idle %u, reset\n", op->idle);
+        break;
+    }
+  }
+  printf("Reference state:\n");
+  ay3ref_dump(t->ref, stdout);
+  printf("Optimized state:\n");
+  ay3_dump(t->opt, stdout);
+  exit(1);
+}
+
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Generate a random bus operation, biased towards audible settings
+static void random_op(uint32_t *rng, bus_op *op) {
+  uint32_t r = xorshift32(rng);
+
+  // Mostly short gaps, occasionally long ones
+  op->idle = (r & 0x0f) ? xorshift32(rng) % 2000 : xorshift32(rng) % 200000;
+
+  r = xorshift32(rng) % 100;
+  if (r < 1) {
+    op->kind = OP_RESET;
+    op->reg = op->val = 0;
+  } else if (r < 10) {
+    op->kind = OP_READ;
+    op->reg = xorshift32(rng) % 17;  // Includes an undecoded register
+    op->val = 0;
+  } else {
+    op->kind = OP_WRITE;
+    op->reg = xorshift32(rng) % 16;
+    op->val = xorshift32(rng);
+    if ((op->reg == 1) || (op->reg == 3) || (op->reg == 5) || (op->reg == 12)) {
+      // Keep periods mostly short enough to hear several cycles
+      op->val &= (xorshift32(rng) & 1) ? 0x01 : 0xff;
+    }
+  }
+}
+
+// Load a corpus file of bus operations
+static bus_op *load_corpus(const char *path, unsigned int *count) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    exit(2);
+  }
+  unsigned int n = 0, size = 256;
+  bus_op *ops = malloc(size * sizeof(bus_op));
+  char line[256];
+  unsigned int lineno = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ++lineno;
+    char *hash = strchr(line, '#');
+    if (hash) {
+      *hash = '\0';
+    }
+    char a[32], b[32], c[32];
+    int fields = sscanf(line, "%31s %31s %31s", a, b, c);
+    if (fields <= 0) {
+      continue;
+    }
+    if (n == size) {
+      size *= 2;
+      ops = realloc(ops, size * sizeof(bus_op));
+    }
+    if (!ops) {
+      printf("Alloc fail!");
+      exit(999);
+    }
+    bus_op *op = &ops[n++];
+    op->idle = strtoul(a, NULL, 0);
+    op->reg = op->val = 0;
+    if ((fields == 2) && (strcmp(b, "reset") == 0)) {
+      op->kind = OP_RESET;
+    } else if ((fields == 3) && (strcmp(b, "read") == 0)) {
+      op->kind = OP_READ;
+      op->reg = strtoul(c, NULL, 0);
+    } else if (fields == 3) {
+      op->kind = OP_WRITE;
+      op->reg = strtoul(b, NULL, 0);
+      op->val = strtoul(c, NULL, 0);
+    } else {
+      fprintf(stderr, "%s:%u: bad operation\n", path, lineno);
+      exit(2);
+    }
+  }
+  fclose(f);
+  *count = n;
+  return ops;
+}
+
@@ -7,29 +7,95 @@
 #endif
  
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
  
 #include <pulse/simple.h>
 #include <pulse/error.h>
 
 #include "ay-3-8913.h"
+#include "recorder.h"
+#include "ssi263.h"
+#include "stats.h"
  
 #define BUFSIZE 1024
 
+/* Audio buffers and tables are carved out of this, as they would be on the Pico */
+static _Alignas(8) uint8_t audio_mem[AY3_DEFAULT_SAMPLES + sizeof(ssi263_tables)];
+
+/* Blocks of recording buffer, about 4s at the default sample rate */
+#define RECORD_BLOCKS 64
+
+/* Time one clock in this many (plus one) for the stage statistics */
+#define STATS_SAMPLE_MASK 1023
+
+/* Phonemes spoken over and over with -p: "hello" */
+static const uint8_t phrase[] = {0x2a, 0x0a, 0x20, 0x11, 0x13, 0x00};
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_sigint(int sig) {
+    stop = 1;
+}
+
+/* Usage: pulse-test [-s secs] [-j] [-p] [recording.wav|recording.raw]
+ *   -s secs  Print statistics every secs seconds, and on exit
+ *   -j       Print statistics as JSON
+ *   -p       Speak through an SSI-263 as well */
 int main(int argc, char*argv[]) {
 
+    double stats_interval = 0;
+    stats_format stats_fmt = STATS_FORMAT_TEXT;
+    const char *rec_path = NULL;
+    bool speech = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:jp")) != -1) {
+        switch (opt) {
+            case 's':
+                stats_interval = atof(optarg);
+                break;
+            case 'j':
+                stats_fmt = STATS_FORMAT_JSON;
+                break;
+            case 'p':
+                speech = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s secs] [-j] [-p] [recording.wav|recording.raw]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc)
+        rec_path = argv[optind];
+
+    arena mem;
+    arena_init(&mem, audio_mem, sizeof(audio_mem));
+
+    via_state *via1 = create_via(NULL);
+    ay3_state *ay3_1= create_ay3(NULL, &mem);
+
+    /* No tracing of the SSI-263, as it would print from inside the
+     * synthesis loop on every phoneme */
+    ssi263_state *ssi = NULL;
+    if (speech) {
+        ssi263_config ssi_cfg;
+        ssi263_default_config(&ssi_cfg);
+        ssi_cfg.trace = false;
+        ssi = create_ssi263(&ssi_cfg, &mem);
+    }
+
     /* The Sample format to use */
-    static const pa_sample_spec ss = {
+    const pa_sample_spec ss = {
         .format = PA_SAMPLE_U8,
-        .rate = AY3_SAMPLERATE,
+        .rate = ay3_1->cold.cfg.samplerate,
         .channels = 1
     };
- 
-    via_state *via1 = create_via();
-    ay3_state *ay3_1= create_ay3();
 
     // Set up VIA for output
     via_clk(via1, true, false, true, VIAREG_DDRA, 0xff);
@@ -80,17 +146,64 @@ int main(int argc, char*argv[]) {
       ay3_clk(ay3_1, via1);
     }
 
+    /* Set up the SSI-263 as a driver would, and start it speaking. It will
+     * then request each phoneme through CA1. */
+    unsigned int next_phoneme = 1;
+    if (ssi) {
+        via_clk(via1, true, false, true, VIAREG_PCR, 0x00);  // CA1 on negative edge
+        via_clk(via1, true, false, true, VIAREG_IER, 0x82);  // Enable CA1 interrupt
+        //             via   cs    rs               data
+        ssi263_clk(ssi, via1, true, SSIREG_CTLAMP,  0x80);   // Standby
+        ssi263_clk(ssi, via1, true, SSIREG_DURPHON, 0x00);   // A/R' on each phoneme
+        ssi263_clk(ssi, via1, true, SSIREG_INFLECT, 0x50);
+        ssi263_clk(ssi, via1, true, SSIREG_RATEINF, 0xa8);
+        ssi263_clk(ssi, via1, true, SSIREG_FILFREQ, SSI263_FF_NOMINAL);
+        ssi263_clk(ssi, via1, true, SSIREG_CTLAMP,  0x7f);   // Articulation, amplitude
+        ssi263_clk(ssi, via1, true, SSIREG_DURPHON, phrase[0]);
+    }
+
     pa_simple *s = NULL;
+    recorder *rec = NULL;
     int ret = 1;
     int error;
- 
+
+    loop_stats stats;
+    double next_dump = stats_interval;
+
+    /* Optionally record alongside playback */
+    if (rec_path) {
+        const char *ext = strrchr(rec_path, '.');
+        rec_format fmt = (ext && strcasecmp(ext, ".wav") == 0) ? REC_FORMAT_WAV : REC_FORMAT_RAW;
+        if (!(rec = create_recorder(rec_path, fmt, ay3_1->cold.cfg.samplerate,
+                                    ay3_1->hot.samples, RECORD_BLOCKS))) {
+            fprintf(stderr, __FILE__": cannot record to %s\n", rec_path);
+            goto finish;
+        }
+    }
+
     /* Create a new playback stream */
     if (!(s = pa_simple_new(NULL, argv[0], PA_STREAM_PLAYBACK, NULL, "playback", &ss, NULL, NULL, &error))) {
         fprintf(stderr, __FILE__": pa_simple_new() failed: %s\n", pa_strerror(error));
         goto finish;
     }
 
-    for (;;) {
+    /* Start the clock only now, so that connecting to the server is not
+     * counted against realtime or seen as an underrun */
+    stats_init(&stats, STATS_SAMPLE_MASK);
+
+    /* Speech is mixed into each block on its way to the recorder, and the
+     * time this takes is measured as it goes */
+    if (ssi) {
+        ssi263_set_next_sink(ssi, rec ? recorder_block : NULL, rec);
+        stats_set_next_sink(&stats, ssi263_block, ssi);
+    } else if (rec) {
+        stats_set_next_sink(&stats, recorder_block, rec);
+    }
+    if (rec || ssi)
+        ay3_set_block_sink(ay3_1, stats_block, &stats);
+    signal(SIGINT, handle_sigint);
+
+    while (!stop) {
 #if 0
         pa_usec_t latency;
  
@@ -102,18 +215,49 @@ int main(int argc, char*argv[]) {
         fprintf(stderr, "%0.0f usec    \r", (float)latency);
 #endif
 
-        for (unsigned int i = 0; i < 16 * AY3_SAMPLES; ++i) {
-          /* Crank the handle */
-          //            cs1   cs2b   rwb   rs  data
-          via_clk(via1, true, false, true, 0, 0b100); // AY3 inactive
-          ay3_clk(ay3_1, via1);
+        uint32_t blocks = ay3_1->hot.blocks;
+        while (ay3_1->hot.blocks == blocks) {
+          /* When the SSI-263 wants a phoneme, CA1 raises IRQ' (it is the
+           * only interrupt enabled). Read port A to acknowledge it and send
+           * the next, as the driver's interrupt handler would. */
+          bool request = ssi && !via1->hot.irqb;
+          /* Crank the handle until the output buffer is full */
+          if (stats_sample(&stats, ay3_1->hot.clocks)) {
+            uint64_t t0 = stats_timestamp();
+            via_clk(via1, true, false, !request, request ? VIAREG_IRA : 0, 0b100);
+            uint64_t t1 = stats_timestamp();
+            ay3_clk(ay3_1, via1);
+            uint64_t t2 = stats_timestamp();
+            stats_stage_add(&stats, STATS_STAGE_VIA, t1 - t0);
+            stats_stage_add(&stats, STATS_STAGE_AY3, t2 - t1);
+            if (ssi) {
+              ssi263_clk(ssi, via1, request, SSIREG_DURPHON, phrase[next_phoneme]);
+              stats_stage_add(&stats, STATS_STAGE_SSI, stats_timestamp() - t2);
+            }
+          } else {
+            //            cs1   cs2b   rwb       rs                           data
+            via_clk(via1, true, false, !request, request ? VIAREG_IRA : 0, 0b100); // AY3 inactive
+            ay3_clk(ay3_1, via1);
+            if (ssi)
+              ssi263_clk(ssi, via1, request, SSIREG_DURPHON, phrase[next_phoneme]);
+          }
+          if (request)
+            next_phoneme = (next_phoneme + 1) % sizeof(phrase);
         }
+        stats_block_ready(&stats, ay3_1->hot.samples, ay3_1->cold.cfg.samplerate);
  
         /* ... and play it */
-        if (pa_simple_write(s, ay3_1->output, (size_t) AY3_SAMPLES, &error) < 0) {
+        uint64_t t0 = stats_timestamp();
+        if (pa_simple_write(s, ay3_1->cold.completed, (size_t) ay3_1->hot.samples, &error) < 0) {
             fprintf(stderr, __FILE__": pa_simple_write() failed: %s\n", pa_strerror(error));
             goto finish;
         }
+        stats_stage_add(&stats, STATS_STAGE_OUTPUT, stats_timestamp() - t0);
+
+        if ((stats_interval > 0) && (stats_elapsed(&stats) >= next_dump)) {
+            stats_dump(stderr, stats_fmt, &stats, ay3_1, via1, ssi);
+            next_dump += stats_interval;
+        }
     }
  
     /* Make sure that every single sample was played */
@@ -125,9 +269,28 @@ int main(int argc, char*argv[]) {
     ret = 0;
  
 finish:
+
+    if ((stats_interval > 0) && s)
+        stats_dump(stderr, stats_fmt, &stats, ay3_1, via1, ssi);
  
     if (s)
         pa_simple_free(s);
+
+    if (s && (rec || ssi))
+        ay3_set_block_sink(ay3_1, NULL, NULL);
+
+    if (ssi)
+        destroy_ssi263(ssi);
+
+    if (rec) {
+        if (recorder_dropped(rec) > 0)
+            fprintf(stderr, __FILE__": recording dropped %llu blocks\n",
+                    (unsigned long long)recorder_dropped(rec));
+        if (!destroy_recorder(rec)) {
+            fprintf(stderr, __FILE__": recording to %s failed\n", rec_path);
+            ret = 1;
+        }
+    }
  
     return ret;
 }
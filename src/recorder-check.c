@@ -0,0 +1,149 @@
+//
+// Check of recordings made by recorder.c
+//
+// Records a number of whole blocks and a partial final block from an AY3,
+// in both WAV and raw format, then reads the file back and checks the
+// RIFF and data chunk sizes, the pad byte and the file length. The pool is
+// kept small, so that it is likely to be empty when the final block is
+// passed on detach. On the first mismatch we exit with status 1.
+//
+// Usage: recorder-check
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ay-3-8913.h"
+#include "recorder.h"
+
+#define CHECK_SAMPLES 1000   // Samples in each block
+#define CHECK_POOL    4      // Blocks in the recorder pool
+
+// Recordings to make
+typedef struct {
+  uint32_t blocks;    // Whole blocks
+  uint32_t tail;      // Samples in the final partial block
+} check_case;
+
+static const check_case cases[] = {
+  {3, 7},   // Odd length, needs a pad byte
+  {3, 6},
+  {2, 0},   // Nothing left over on detach
+  {0, 5},   // Only a partial block
+};
+
+// Prototypes for private functions
+static bool check_record(const char *path, rec_format format, const check_case *c);
+static uint32_t get_le32(const uint8_t *p);
+
+
+int main(int argc, char *argv[]) {
+  char path[] = "/tmp/recorder-check-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return 2;
+  }
+  close(fd);
+
+  bool ok = true;
+  for (unsigned int i = 0; ok && (i < sizeof(cases) / sizeof(cases[0])); ++i) {
+    ok = check_record(path, REC_FORMAT_WAV, &cases[i]) &&
+         check_record(path, REC_FORMAT_RAW, &cases[i]);
+  }
+  unlink(path);
+  if (!ok) {
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
+
+// Make a recording and check what was written
+// Returns true if the file is as expected
+static bool check_record(const char *path, rec_format format, const check_case *c) {
+  const char *name = (format == REC_FORMAT_WAV) ? "wav" : "raw";
+  uint32_t data = c->blocks * CHECK_SAMPLES + c->tail;
+
+  ay3_config cfg;
+  ay3_default_config(&cfg);
+  cfg.samples = CHECK_SAMPLES;
+  cfg.trace = false;
+  via_config vcfg;
+  via_default_config(&vcfg);
+  vcfg.trace = false;
+  via_state *via = create_via(&vcfg);
+  ay3_state *ay3 = create_ay3(&cfg, NULL);
+  recorder *rec = create_recorder(path, format, cfg.samplerate, CHECK_SAMPLES, CHECK_POOL);
+  if (!rec) {
+    return false;
+  }
+  via_clk(via, true, false, true, VIAREG_DDRB, 0xff);
+  ay3_set_block_sink(ay3, recorder_block, rec);
+  while ((ay3->hot.blocks < c->blocks) || (ay3->hot.idx < c->tail)) {
+    via_clk(via, true, false, true, VIAREG_ORB, 0b100); // AY3 inactive
+    ay3_clk(ay3, via);
+  }
+  ay3_set_block_sink(ay3, NULL, NULL);
+  uint64_t dropped = recorder_dropped(rec);
+  bool written = destroy_recorder(rec);
+  destroy_ay3(ay3);
+  destroy_via(via);
+
+  printf("%s %u blocks + %u samples: ", name, c->blocks, c->tail);
+  if (!written || (dropped > 0)) {
+    printf("FAIL: recording failed, %llu blocks dropped\n", (unsigned long long)dropped);
+    return false;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  uint8_t *buf = malloc(data + 64);
+  if (!buf) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  size_t len = fread(buf, 1, data + 64, f);
+  fclose(f);
+
+  bool ok = true;
+  if (format == REC_FORMAT_RAW) {
+    if (len != data) {
+      printf("FAIL: file is %zu bytes, expected %u\n", len, data);
+      ok = false;
+    }
+  } else {
+    uint32_t pad = data & 1;
+    if (len != 44 + data + pad) {
+      printf("FAIL: file is %zu bytes, expected %u\n", len, 44 + data + pad);
+      ok = false;
+    } else if ((memcmp(buf, "RIFF", 4) != 0) || (memcmp(buf + 8, "WAVE", 4) != 0) ||
+               (memcmp(buf + 36, "data", 4) != 0)) {
+      printf("FAIL: not a canonical WAV header\n");
+      ok = false;
+    } else if (get_le32(buf + 4) != len - 8) {
+      printf("FAIL: RIFF size %u, expected %zu\n", get_le32(buf + 4), len - 8);
+      ok = false;
+    } else if (get_le32(buf + 40) != data) {
+      printf("FAIL: data size %u, expected %u\n", get_le32(buf + 40), data);
+      ok = false;
+    } else if (pad && (buf[len - 1] != 0x80)) {
+      printf("FAIL: pad byte is 0x%02x\n", buf[len - 1]);
+      ok = false;
+    }
+  }
+  if (ok) {
+    printf("%zu bytes ok\n", len);
+  }
+  free(buf);
+  return ok;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
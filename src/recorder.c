@@ -0,0 +1,315 @@
+//
+// Recording of emulator output to WAV or raw files
+//
+
+#include "recorder.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REC_ALIGN       4096    // Alignment of buffers and file writes
+#define REC_WRITE_SIZE  65536   // Size of each write to the file
+#define REC_WAV_HEADER  44      // Size of canonical WAV header
+#define REC_IDLE_NS     2000000 // Writer thread poll interval when idle
+
+// A block of samples in a queue
+typedef struct {
+  uint8_t  *buf;
+  uint32_t len;
+} rec_entry;
+
+// Single producer, single consumer queue of blocks. Sized so that it can
+// hold every block in the pool and so can never be full.
+typedef struct {
+  rec_entry   *entries;
+  unsigned int size;
+  atomic_uint  head;  // Next entry to pop, written by consumer
+  atomic_uint  tail;  // Next entry to push, written by producer
+} rec_queue;
+
+// State of recorder
+struct recorder {
+  int          fd;
+  rec_format   format;
+  uint32_t     samplerate;
+  uint32_t     block_samples;
+  unsigned int nblocks;
+  uint8_t      *pool;      // nblocks blocks of block_samples
+
+  rec_queue    filled;     // Synthesis thread -> writer thread
+  rec_queue    free;       // Writer thread -> synthesis thread
+
+  // Writer thread only
+  uint8_t      *staging;   // Aligned buffer of REC_WRITE_SIZE
+  size_t       staged;     // Bytes in staging
+  uint64_t     data_bytes; // Sample bytes written to file
+  bool         failed;     // A write has failed
+
+  pthread_t    thread;
+  atomic_bool  stop;
+  _Atomic uint64_t dropped;
+};
+
+// Prototypes for private functions
+static bool rec_queue_init(rec_queue *q, unsigned int size);
+static bool rec_queue_push(rec_queue *q, rec_entry e);
+static bool rec_queue_pop(rec_queue *q, rec_entry *e);
+static void *recorder_thread(void *arg);
+static void recorder_stage(recorder *r, const uint8_t *buf, uint32_t len);
+static void recorder_write(recorder *r, const uint8_t *buf, size_t len);
+static void recorder_wav_header(recorder *r, uint8_t *hdr);
+static void put_le16(uint8_t *p, uint16_t v);
+static void put_le32(uint8_t *p, uint32_t v);
+
+
+recorder *create_recorder(const char *path, rec_format format, uint32_t samplerate,
+                          uint32_t block_samples, unsigned int nblocks) {
+  if ((block_samples == 0) || (nblocks < 2)) {
+    return NULL;
+  }
+  recorder *r = calloc(1, sizeof(recorder));
+  if (!r) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  r->format        = format;
+  r->samplerate    = samplerate;
+  r->block_samples = block_samples;
+  r->nblocks       = nblocks;
+
+  // Keep every block aligned for the benefit of the synthesis side
+  size_t stride = (block_samples + 63) & ~(size_t)63;
+  r->pool    = aligned_alloc(REC_ALIGN, (stride * nblocks + REC_ALIGN - 1) & ~(size_t)(REC_ALIGN - 1));
+  r->staging = aligned_alloc(REC_ALIGN, REC_WRITE_SIZE);
+  if (!r->pool || !r->staging ||
+      !rec_queue_init(&r->filled, nblocks + 1) ||
+      !rec_queue_init(&r->free, nblocks + 1)) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  for (unsigned int i = 0; i < nblocks; ++i) {
+    rec_entry e = {r->pool + i * stride, 0};
+    rec_queue_push(&r->free, e);
+  }
+
+  r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (r->fd < 0) {
+    perror(path);
+    free(r->filled.entries);
+    free(r->free.entries);
+    free(r->staging);
+    free(r->pool);
+    free(r);
+    return NULL;
+  }
+
+  // The WAV header goes at the front of the first write, so that all the
+  // writes stay aligned. It is filled in properly on close.
+  if (format == REC_FORMAT_WAV) {
+    recorder_wav_header(r, r->staging);
+    r->staged = REC_WAV_HEADER;
+  }
+
+  atomic_init(&r->stop, false);
+  atomic_init(&r->dropped, 0);
+  if (pthread_create(&r->thread, NULL, recorder_thread, r) != 0) {
+    printf("Recorder: cannot create thread!");
+    exit(999);
+  }
+  return r;
+}
+
+bool destroy_recorder(recorder *r) {
+  atomic_store_explicit(&r->stop, true, memory_order_release);
+  pthread_join(r->thread, NULL);
+
+  if (r->format == REC_FORMAT_WAV) {
+    uint8_t hdr[REC_WAV_HEADER];
+    recorder_wav_header(r, hdr);
+    if (pwrite(r->fd, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+      r->failed = true;
+    }
+  }
+  if (close(r->fd) != 0) {
+    r->failed = true;
+  }
+  bool ok = !r->failed;
+
+  free(r->filled.entries);
+  free(r->free.entries);
+  free(r->staging);
+  free(r->pool);
+  free(r);
+  return ok;
+}
+
+// Called on the synthesis thread, so must never block
+uint8_t *recorder_block(void *ctx, uint8_t *block, uint32_t samples, bool last) {
+  recorder *r = ctx;
+  rec_entry next;
+
+  if (last) {
+    // No buffer is wanted back, so there is no need for a free one. The
+    // filled queue can hold the whole pool, so this cannot fail.
+    if (samples > 0) {
+      rec_entry done = {block, samples};
+      rec_queue_push(&r->filled, done);
+    }
+    return NULL;
+  }
+  if (!rec_queue_pop(&r->free, &next)) {
+    // Writer has fallen behind. Drop this block and reuse it.
+    if (block) {
+      atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+      return block;
+    }
+    // Cannot happen: the whole pool is free when the sink is attached
+    return NULL;
+  }
+  if (block) {
+    rec_entry done = {block, samples};
+    rec_queue_push(&r->filled, done);
+  }
+  return next.buf;
+}
+
+uint64_t recorder_dropped(recorder *r) {
+  return atomic_load_explicit(&r->dropped, memory_order_relaxed);
+}
+
+static bool rec_queue_init(rec_queue *q, unsigned int size) {
+  q->entries = malloc(size * sizeof(rec_entry));
+  q->size = size;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  return q->entries != NULL;
+}
+
+// Push an entry, returns false if the queue is full
+static bool rec_queue_push(rec_queue *q, rec_entry e) {
+  unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  unsigned int next = (tail + 1) % q->size;
+  if (next == atomic_load_explicit(&q->head, memory_order_acquire)) {
+    return false;
+  }
+  q->entries[tail] = e;
+  atomic_store_explicit(&q->tail, next, memory_order_release);
+  return true;
+}
+
+// Pop an entry, returns false if the queue is empty
+static bool rec_queue_pop(rec_queue *q, rec_entry *e) {
+  unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+    return false;
+  }
+  *e = q->entries[head];
+  atomic_store_explicit(&q->head, (head + 1) % q->size, memory_order_release);
+  return true;
+}
+
+// Writer thread. Moves filled blocks to the file and back to the pool.
+static void *recorder_thread(void *arg) {
+  recorder *r = arg;
+  const struct timespec idle = {0, REC_IDLE_NS};
+
+  for (;;) {
+    // Check for stop before the queue, so that once stop is seen every
+    // block queued before it is visible and gets written
+    bool stopping = atomic_load_explicit(&r->stop, memory_order_acquire);
+    rec_entry e;
+    if (rec_queue_pop(&r->filled, &e)) {
+      recorder_stage(r, e.buf, e.len);
+      rec_queue_push(&r->free, e);
+    } else if (stopping) {
+      break;
+    } else {
+      nanosleep(&idle, NULL);
+    }
+  }
+
+  // RIFF chunks are padded to an even length
+  if ((r->format == REC_FORMAT_WAV) && (r->data_bytes & 1)) {
+    const uint8_t pad = 0x80;
+    recorder_stage(r, &pad, 1);
+    --r->data_bytes;
+  }
+
+  // Write out the final partial chunk
+  recorder_write(r, r->staging, r->staged);
+  r->staged = 0;
+  return NULL;
+}
+
+// Copy samples into the staging buffer, writing it out whenever it fills
+static void recorder_stage(recorder *r, const uint8_t *buf, uint32_t len) {
+  r->data_bytes += len;
+  while (len > 0) {
+    size_t n = REC_WRITE_SIZE - r->staged;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(r->staging + r->staged, buf, n);
+    r->staged += n;
+    buf += n;
+    len -= n;
+    if (r->staged == REC_WRITE_SIZE) {
+      recorder_write(r, r->staging, REC_WRITE_SIZE);
+      r->staged = 0;
+    }
+  }
+}
+
+// Write to the file, retrying short writes. After a failure we carry on
+// draining the queue but stop writing.
+static void recorder_write(recorder *r, const uint8_t *buf, size_t len) {
+  while ((len > 0) && !r->failed) {
+    ssize_t n = write(r->fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Recorder: write");
+      r->failed = true;
+    } else {
+      buf += n;
+      len -= n;
+    }
+  }
+}
+
+// Build the WAV header for the data written so far
+static void recorder_wav_header(recorder *r, uint8_t *hdr) {
+  uint32_t data = (r->data_bytes > 0xffffffffu - 37) ? 0xffffffffu - 37 : r->data_bytes;
+  memcpy(hdr, "RIFF", 4);
+  put_le32(hdr + 4, 36 + data + (data & 1)); // Rest of file, with pad byte
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  put_le32(hdr + 16, 16);                 // Size of fmt chunk
+  put_le16(hdr + 20, 1);                  // PCM
+  put_le16(hdr + 22, 1);                  // Mono
+  put_le32(hdr + 24, r->samplerate);      // Sample rate
+  put_le32(hdr + 28, r->samplerate);      // Byte rate
+  put_le16(hdr + 32, 1);                  // Block align
+  put_le16(hdr + 34, 8);                  // Bits per sample
+  memcpy(hdr + 36, "data", 4);
+  put_le32(hdr + 40, data);               // Size of data chunk
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = v >> 24;
+}
+
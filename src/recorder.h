@@ -0,0 +1,51 @@
+//
+// Recording of emulator output to WAV or raw files
+//
+// The recorder owns a pool of sample blocks which it lends to the AY3 as
+// output buffers (see ay3_set_block_sink()). Completed blocks are queued
+// to a background thread which writes them out in large aligned chunks,
+// then returns them to the pool. The synthesis side never blocks, takes no
+// locks and makes no system calls: if the disk falls behind and the pool
+// runs dry, the block is dropped (and counted) rather than stalling
+// synthesis. This is host-side QA tooling; it needs POSIX threads.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// File formats
+typedef enum {
+  REC_FORMAT_RAW,  // Unsigned 8 bit mono samples, no header
+  REC_FORMAT_WAV   // As above, in a RIFF/WAVE container
+} rec_format;
+
+typedef struct recorder recorder;
+
+// Create a recorder and start its writer thread
+// Params: path - file to write
+//         format - file format
+//         samplerate - sample rate for the WAV header (Hz)
+//         block_samples - size of each block, must match the AY3 cfg.samples
+//         nblocks - number of blocks in the pool, which sets how far the
+//                   disk may fall behind before blocks are dropped
+// Returns recorder handle, or NULL if the file cannot be created
+recorder *create_recorder(const char *path, rec_format format, uint32_t samplerate,
+                          uint32_t block_samples, unsigned int nblocks);
+
+// Drain outstanding blocks, fix up the WAV header, close the file and
+// destroy the recorder. Must be detached from the AY3 first.
+// Params: r - recorder handle
+// Returns true if everything was written without error
+bool destroy_recorder(recorder *r);
+
+// Block sink for ay3_set_block_sink(), with the recorder handle as ctx.
+// Called on the synthesis thread. The final block, passed on detach, is
+// always queued.
+uint8_t *recorder_block(void *ctx, uint8_t *block, uint32_t samples, bool last);
+
+// Number of blocks dropped because the writer had fallen behind
+// Params: r - recorder handle
+uint64_t recorder_dropped(recorder *r);
+
@@ -0,0 +1,556 @@
+//
+// Emulation of Silicon Systems SSI-263 Speech Chip
+//
+
+#include "ssi263.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define SSI263_UPDATE   16   // Synthesizer samples between parameter updates
+#define SSI263_ONE      8192 // 1.0 in the 2.13 resonator coefficients
+#define SSI263_NOISE    512  // Level of noise source, per unit of amplitude
+#define SSI263_CLAMP    32767
+#define SSI263_OUT_SHIFT 10  // Scale of resonator output to mixed output
+#define SSI263_OUT_MAX  63   // Largest excursion of mixed output
+#define SSI263_SETTLED  8    // Resonator outputs this small are inaudible
+
+// Once the SSI-263 is attached, the AY3's output is halved and speech is
+// added around an offset, so that the sum lies in 1..254 and can never
+// clip. The offset is there even in standby, as a step in DC when speech
+// started would be heard as a click.
+#define SSI263_AY3_SHIFT 1
+#define SSI263_DC       64
+
+// Inflection I11..I0 maps linearly onto this range of pitch
+#define SSI263_PITCH_MIN   50   // Hz
+#define SSI263_PITCH_RANGE 250  // Hz
+
+// Phoneme table entry
+typedef struct {
+  const char *name;
+  uint16_t f1, f2, f3;  // Formant frequencies (Hz)
+  uint8_t  voice;       // Voicing amplitude, 0-15
+  uint8_t  noise;       // Frication amplitude, 0-15
+  uint8_t  ms;          // Nominal duration (ms)
+} ssi263_phoneme;
+
+// The 64 phonemes, in SSI-263 order
+static const ssi263_phoneme phonemes[SSI263_PHONEMES] = {
+  //  name    f1    f2    f3 voice noise  ms
+  {"PA",     500, 1500, 2500,  0,  0,  50},
+  {"E",      270, 2290, 3010, 15,  0, 160},
+  {"E1",     300, 2200, 2950, 15,  0, 120},
+  {"Y",      280, 2250, 2900, 13,  0,  80},
+  {"YI",     300, 2100, 2800, 14,  0, 100},
+  {"AY",     560, 1900, 2600, 15,  0, 160},
+  {"IE",     400, 2000, 2700, 15,  0, 120},
+  {"I",      390, 1990, 2550, 15,  0, 100},
+  {"A",      530, 1840, 2480, 15,  0, 160},
+  {"AI",     600, 1750, 2500, 15,  0, 120},
+  {"EH",     530, 1840, 2480, 15,  0, 100},
+  {"EH1",    580, 1800, 2450, 15,  0,  80},
+  {"AE",     660, 1720, 2410, 15,  0, 160},
+  {"AE1",    700, 1650, 2400, 15,  0, 100},
+  {"AH",     730, 1090, 2440, 15,  0, 160},
+  {"AH1",    750, 1150, 2400, 15,  0, 100},
+  {"W",      300,  700, 2200, 12,  0,  80},
+  {"O",      570,  840, 2410, 15,  0, 160},
+  {"OU",     500,  900, 2350, 15,  0, 120},
+  {"OO",     300,  870, 2240, 15,  0, 160},
+  {"IU",     350, 1200, 2300, 15,  0, 120},
+  {"IU1",    400, 1300, 2300, 15,  0, 100},
+  {"U",      440, 1020, 2240, 15,  0, 140},
+  {"U1",     470, 1100, 2250, 15,  0, 100},
+  {"UH",     640, 1190, 2390, 15,  0, 120},
+  {"UH1",    620, 1250, 2400, 15,  0, 100},
+  {"UH2",    600, 1300, 2400, 14,  0,  80},
+  {"UH3",    550, 1350, 2450, 13,  0,  60},
+  {"ER",     490, 1350, 1690, 15,  0, 160},
+  {"R",      420, 1300, 1600, 14,  0,  90},
+  {"R1",     450, 1250, 1550, 14,  0,  70},
+  {"R2",     460, 1200, 1500, 13,  0,  60},
+  {"L",      360, 1100, 2700, 13,  0,  90},
+  {"L1",     380, 1000, 2650, 13,  0,  70},
+  {"LF",     400,  950, 2600, 12,  0,  60},
+  {"W",      320,  650, 2200, 12,  0,  70},
+  {"B",      200, 1100, 2150, 10,  2,  50},
+  {"D",      200, 1600, 2600, 10,  3,  50},
+  {"KV",     250, 1900, 2500,  9,  4,  60},
+  {"P",      400, 1100, 2150,  0,  8,  60},
+  {"T",      400, 1600, 2600,  0, 10,  60},
+  {"K",      400, 1900, 2500,  0,  9,  70},
+  {"HV",     500, 1500, 2500,  6,  6,  60},
+  {"HVC",    500, 1500, 2500,  5,  5,  50},
+  {"HF",     500, 1500, 2500,  0,  7,  70},
+  {"HFC",    500, 1500, 2500,  0,  6,  50},
+  {"HN",     450, 1500, 2500,  3,  6,  60},
+  {"Z",      250, 1700, 2700,  9, 10, 100},
+  {"S",      400, 1700, 2700,  0, 13, 110},
+  {"J",      250, 1900, 2600,  9,  9,  90},
+  {"SCH",    400, 1900, 2600,  0, 12, 110},
+  {"V",      250, 1100, 2400,  9,  7,  80},
+  {"F",      400, 1100, 2400,  0,  9,  90},
+  {"THV",    250, 1400, 2600,  9,  6,  70},
+  {"TH",     400, 1400, 2600,  0,  8,  90},
+  {"M",      250, 1000, 2200, 13,  0,  90},
+  {"N",      250, 1700, 2600, 13,  0,  90},
+  {"NG",     250, 2300, 2750, 13,  0,  90},
+  {":A",     600, 1500, 2300, 15,  0, 140},
+  {":OH",    500, 1000, 2300, 15,  0, 140},
+  {":U",     350, 1600, 2200, 15,  0, 140},
+  {":UH",    550, 1400, 2350, 15,  0, 120},
+  {"E2",     300, 2100, 2900, 15,  0, 140},
+  {"LB",     350,  900, 2600, 13,  0,  90}
+};
+
+// Bandwidth of each formant resonator (Hz)
+static const uint16_t bandwidths[3] = {60, 90, 150};
+
+// Prototypes for private functions
+static void ssi263_build_tables(ssi263_state *h, ssi263_tables *t);
+static void ssi263_set_register(ssi263_state *h, via_state *via, unsigned int reg, uint8_t val);
+static void ssi263_set_ar(ssi263_state *h, via_state *via, bool level);
+static void ssi263_phoneme_end(ssi263_state *h, via_state *via);
+static void ssi263_derive_params(ssi263_state *h, ssi263_params *p);
+static void ssi263_log_event(ssi263_state *h);
+static void ssi263_render(ssi263_state *h, uint8_t *block, uint32_t samples);
+static void ssi263_render_span(ssi263_state *h, uint8_t *block, uint32_t from, uint32_t to);
+static bool ssi263_quiet(ssi263_synth *s);
+static inline int32_t ssi263_sample(ssi263_synth *s);
+static void ssi263_glide(ssi263_synth *s);
+
+
+void ssi263_default_config(ssi263_config *cfg) {
+  cfg->clockspeed = SSI263_DEFAULT_CLOCKSPEED;
+  cfg->samplerate = SSI263_DEFAULT_SAMPLERATE;
+  cfg->synthrate  = SSI263_DEFAULT_SYNTHRATE;
+  cfg->trace      = true;
+}
+
+ssi263_state *create_ssi263(const ssi263_config *cfg, arena *mem) {
+  ssi263_state *h = malloc(sizeof(ssi263_state));
+  if (!h) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  if (cfg) {
+    h->cold.cfg = *cfg;
+  } else {
+    ssi263_default_config(&h->cold.cfg);
+  }
+  cfg = &h->cold.cfg;
+  if ((cfg->clockspeed == 0) ||
+      (cfg->samplerate == 0) ||
+      (cfg->synthrate == 0) ||
+      (cfg->synthrate > cfg->samplerate)) {
+    printf("SSI263: Bad config!");
+    exit(999);
+  }
+
+  // Run the synthesizer at the output rate divided by a whole number, as
+  // close to the requested rate as possible
+  uint32_t decimate = (cfg->samplerate + cfg->synthrate / 2) / cfg->synthrate;
+  if (decimate > 255) {
+    decimate = 255;
+  }
+  h->synth.decimate  = decimate;
+  h->synth.phase_out = decimate;
+  h->cold.recip      = 256 / decimate;
+  h->cold.synthrate  = cfg->samplerate / decimate;
+
+  ssi263_tables *t = NULL;
+  if (mem) {
+    t = arena_alloc(mem, sizeof(ssi263_tables), 4);
+    h->cold.tables_owned = false;
+  } else {
+    t = malloc(sizeof(ssi263_tables));
+    h->cold.tables_owned = true;
+  }
+  if (!t) {
+    printf("Alloc fail!");
+    exit(999);
+  }
+  ssi263_build_tables(h, t);
+  h->synth.tables = t;
+
+  h->hot.clocks    = 0;
+  h->hot.countdown = 0;
+
+  // Power up in standby, at the nominal filter frequency
+  for (unsigned int i = 0; i < 5; ++i) {
+    h->cold.regs[i] = 0;
+  }
+  h->cold.regs[SSIREG_CTLAMP]  = 0x80;
+  h->cold.regs[SSIREG_FILFREQ] = SSI263_FF_NOMINAL;
+  h->cold.standby    = true;
+  h->cold.ar_enabled = false;
+  h->cold.ar         = true;
+  h->cold.ev_head    = 0;
+  h->cold.ev_count   = 0;
+  h->cold.render_clock = 0;
+  h->cold.next_fn    = NULL;
+  h->cold.next_ctx   = NULL;
+  h->cold.phonemes = h->cold.requests = h->cold.merged = 0;
+
+  ssi263_synth *s = &h->synth;
+  ssi263_derive_params(h, &s->target);
+  s->phase  = 0;
+  s->lfsr   = 1;
+  s->prev   = s->level = s->delta = 0;
+  s->voice  = s->noise = 0;
+  s->update = 1;
+  for (unsigned int k = 0; k < 3; ++k) {
+    s->formant[k] = s->target.formant[k];
+    s->y1[k] = s->y2[k] = 0;
+  }
+  ssi263_glide(s);
+  return h;
+}
+
+void destroy_ssi263(ssi263_state *h) {
+  if (h->cold.tables_owned) {
+    free((void *)h->synth.tables);
+  }
+  free(h);
+}
+
+void ssi263_clk(ssi263_state *h, via_state *via, bool cs, uint8_t rs, uint8_t data) {
+  ++h->hot.clocks;
+  if (h->hot.countdown && (--h->hot.countdown == 0)) {
+    ssi263_phoneme_end(h, via);
+  }
+  if (cs) {
+    ssi263_set_register(h, via, rs, data);
+  }
+}
+
+uint8_t *ssi263_block(void *ctx, uint8_t *block, uint32_t samples, bool last) {
+  ssi263_state *h = ctx;
+  if (block) {
+    ssi263_render(h, block, samples);
+  }
+  if (h->cold.next_fn) {
+    return h->cold.next_fn(h->cold.next_ctx, block, samples, last);
+  }
+  return block;
+}
+
+void ssi263_set_next_sink(ssi263_state *h, ay3_block_fn fn, void *ctx) {
+  h->cold.next_fn  = fn;
+  h->cold.next_ctx = ctx;
+}
+
+void ssi263_get_stats(ssi263_state *h, ssi263_stats *s) {
+  s->clocks   = h->hot.clocks;
+  s->phonemes = h->cold.phonemes;
+  s->requests = h->cold.requests;
+  s->merged   = h->cold.merged;
+}
+
+void ssi263_dump(ssi263_state *h, FILE *f) {
+  ssi263_synth *s = &h->synth;
+  fprintf(f, "  regs:");
+  for (unsigned int i = 0; i < 5; ++i) {
+    fprintf(f, " %02x", h->cold.regs[i]);
+  }
+  fprintf(f, "  phoneme: %s  standby %u  ar_enabled %u  ar %u\n",
+          phonemes[h->cold.regs[SSIREG_DURPHON] & 0x3f].name,
+          h->cold.standby, h->cold.ar_enabled, h->cold.ar);
+  fprintf(f, "  clocks: %llu  countdown: %u  events: %u  render_clock: %llu\n",
+          (unsigned long long)h->hot.clocks, h->hot.countdown, h->cold.ev_count,
+          (unsigned long long)h->cold.render_clock);
+  fprintf(f, "  synth: rate %u decimate %u  voice %u/%u noise %u/%u amplitude %u pitch_step 0x%08x\n",
+          h->cold.synthrate, s->decimate, s->voice, s->target.voice, s->noise,
+          s->target.noise, s->target.amplitude, s->target.pitch_step);
+  for (unsigned int k = 0; k < 3; ++k) {
+    fprintf(f, "  F%u: %uHz/%uHz a1 %d a2 %d g %d y1 %d y2 %d\n", k + 1,
+            s->formant[k] * SSI263_FREQ_STEP, s->target.formant[k] * SSI263_FREQ_STEP,
+            s->a1[k], s->a2[k], s->g[k], s->y1[k], s->y2[k]);
+  }
+}
+
+// Build the phoneme duration, resonator coefficient and glottal pulse
+// tables, so that no floating point is needed once running
+// Params: h - SSI-263 handle
+//         t - tables to fill in [OUT]
+static void ssi263_build_tables(ssi263_state *h, ssi263_tables *t) {
+  const double fs = h->cold.synthrate;
+
+  for (unsigned int i = 0; i < SSI263_PHONEMES; ++i) {
+    t->duration[i] = (uint64_t)phonemes[i].ms * h->cold.cfg.clockspeed / 1000;
+  }
+
+  // Two pole resonators: y[n] = g.x[n] + a1.y[n-1] + a2.y[n-2]
+  // Frequencies too close to Nyquist are held at the highest usable one
+  for (unsigned int k = 0; k < 3; ++k) {
+    double r = exp(-M_PI * bandwidths[k] / fs);
+    for (unsigned int i = 0; i < SSI263_FREQ_STEPS; ++i) {
+      double freq = (double)i * SSI263_FREQ_STEP;
+      if (freq > 0.45 * fs) {
+        freq = 0.45 * fs;
+      }
+      t->a1[k][i] = lround(2.0 * r * cos(2.0 * M_PI * freq / fs) * SSI263_ONE);
+      t->a2[k][i] = lround(-r * r * SSI263_ONE);
+    }
+  }
+
+  // Derivative of a Rosenberg glottal flow pulse: opens over 40% of the
+  // period and closes over 16%. This has no DC, and includes the lip
+  // radiation characteristic.
+  double flow[SSI263_GLOTTAL];
+  for (unsigned int i = 0; i < SSI263_GLOTTAL; ++i) {
+    double p = (double)i / SSI263_GLOTTAL;
+    if (p < 0.40) {
+      flow[i] = 0.5 * (1.0 - cos(M_PI * p / 0.40));
+    } else if (p < 0.56) {
+      flow[i] = cos(0.5 * M_PI * (p - 0.40) / 0.16);
+    } else {
+      flow[i] = 0.0;
+    }
+  }
+  double peak = 0.0;
+  double diff[SSI263_GLOTTAL];
+  for (unsigned int i = 0; i < SSI263_GLOTTAL; ++i) {
+    diff[i] = flow[i] - flow[(i + SSI263_GLOTTAL - 1) % SSI263_GLOTTAL];
+    if (fabs(diff[i]) > peak) {
+      peak = fabs(diff[i]);
+    }
+  }
+  for (unsigned int i = 0; i < SSI263_GLOTTAL; ++i) {
+    t->glottal[i] = lround(diff[i] / peak * 1024.0);
+  }
+}
+
+// Handle CPU writing to an SSI-263 register
+// Params: h - SSI-263 handle
+//         via - VIA handle, for A/R'
+//         reg - register number
+//         val - value written
+static void ssi263_set_register(ssi263_state *h, via_state *via, unsigned int reg, uint8_t val) {
+  if (h->cold.cfg.trace) {
+    printf("SSI263: setting R%d to 0x%x\n", reg, val);
+  }
+  if (reg > SSIREG_FILFREQ) {
+    return;
+  }
+  switch (reg) {
+    case SSIREG_DURPHON:
+      h->cold.regs[reg] = val;
+      // In standby this only selects the mode, applied when CTL is cleared
+      if (!h->cold.standby) {
+        // Duration mode shortens the phoneme by quarters, and the rate
+        // speeds up the whole chip
+        unsigned int dr   = val >> 6;
+        unsigned int rate = h->cold.regs[SSIREG_RATEINF] >> 4;
+        uint64_t d = (uint64_t)h->synth.tables->duration[val & 0x3f] * (4 - dr) * (32 - rate) / 96;
+        h->hot.countdown = d ? d : 1;
+        ++h->cold.phonemes;
+        if (h->cold.ar_enabled) {
+          ssi263_set_ar(h, via, true);
+        }
+      }
+      break;
+    case SSIREG_CTLAMP:
+      h->cold.regs[reg] = val;
+      if (val & 0x80) {
+        // Standby: silent, and no more requests
+        h->cold.standby  = true;
+        h->hot.countdown = 0;
+      } else if (h->cold.standby) {
+        // Leaving standby. Duration mode 3 disables A/R', the others all
+        // request the next phoneme as each one ends.
+        h->cold.standby    = false;
+        h->cold.ar_enabled = ((h->cold.regs[SSIREG_DURPHON] >> 6) != 3);
+      }
+      break;
+    default:
+      h->cold.regs[reg] = val;
+  }
+  ssi263_log_event(h);
+}
+
+// Drive the A/R' output, which goes to the VIA's CA1
+// Params: h - SSI-263 handle
+//         via - VIA handle
+//         level - level of A/R'
+static void ssi263_set_ar(ssi263_state *h, via_state *via, bool level) {
+  h->cold.ar = level;
+  via_set_ca1(via, level);
+}
+
+// Called when the current phoneme's duration is up. The chip carries on
+// sounding it until the next one is written.
+static void ssi263_phoneme_end(ssi263_state *h, via_state *via) {
+  if (h->cold.ar_enabled) {
+    ++h->cold.requests;
+    ssi263_set_ar(h, via, false);
+  }
+}
+
+// Work out the synthesis parameters from the registers
+// Params: h - SSI-263 handle
+//         p - parameters [OUT]
+static void ssi263_derive_params(ssi263_state *h, ssi263_params *p) {
+  const uint8_t *regs = h->cold.regs;
+  const ssi263_phoneme *ph = &phonemes[regs[SSIREG_DURPHON] & 0x3f];
+
+  // Formants scale with the filter frequency
+  const uint32_t f[3] = {ph->f1, ph->f2, ph->f3};
+  const uint32_t div = (SSI263_FF_NOMINAL + 1) * SSI263_FREQ_STEP;
+  for (unsigned int k = 0; k < 3; ++k) {
+    uint32_t i = (f[k] * (regs[SSIREG_FILFREQ] + 1) + div / 2) / div;
+    p->formant[k] = (i < SSI263_FREQ_STEPS) ? i : SSI263_FREQ_STEPS - 1;
+  }
+
+  // Pitch in Hz is (SSI263_PITCH_MIN * 4096 + I * SSI263_PITCH_RANGE) / 4096
+  uint32_t inflection = (regs[SSIREG_INFLECT] << 3) | (regs[SSIREG_RATEINF] & 0x07) |
+                        ((regs[SSIREG_RATEINF] & 0x08) << 8);
+  uint64_t pitch = SSI263_PITCH_MIN * 4096 + inflection * SSI263_PITCH_RANGE;
+  p->pitch_step = (pitch << 20) / h->cold.synthrate;
+
+  p->voice     = h->cold.standby ? 0 : ph->voice;
+  p->noise     = h->cold.standby ? 0 : ph->noise;
+  p->amplitude = regs[SSIREG_CTLAMP] & 0x0f;
+  p->glide     = ((regs[SSIREG_CTLAMP] >> 4) & 0x07) + 1;
+}
+
+// Log the parameters after a register write, for ssi263_render(). If the
+// log is full, the latest entry is updated instead.
+static void ssi263_log_event(ssi263_state *h) {
+  ssi263_cold *c = &h->cold;
+  unsigned int i;
+  if (c->ev_count == SSI263_EVENTS) {
+    ++c->merged;
+    i = (c->ev_head + c->ev_count - 1) % SSI263_EVENTS;
+  } else {
+    i = (c->ev_head + c->ev_count) % SSI263_EVENTS;
+    c->events[i].clock = h->hot.clocks;
+    ++c->ev_count;
+  }
+  ssi263_derive_params(h, &c->events[i].params);
+}
+
+// Mix speech into a block, which covers the clocks since the last one.
+// Each logged register write takes effect at the corresponding sample.
+static void ssi263_render(ssi263_state *h, uint8_t *block, uint32_t samples) {
+  ssi263_cold *c = &h->cold;
+  uint64_t span = h->hot.clocks - c->render_clock;
+  uint32_t pos = 0;
+
+  while (c->ev_count) {
+    ssi263_event *ev = &c->events[c->ev_head];
+    uint64_t at = ev->clock - c->render_clock;
+    uint32_t p = (span && (at < span)) ? at * samples / span : (span ? samples : 0);
+    ssi263_render_span(h, block, pos, p);
+    pos = p;
+    h->synth.target = ev->params;
+    c->ev_head = (c->ev_head + 1) % SSI263_EVENTS;
+    --c->ev_count;
+  }
+  ssi263_render_span(h, block, pos, samples);
+  c->render_clock = h->hot.clocks;
+}
+
+// Mix speech into part of a block
+// Params: h - SSI-263 handle
+//         block - block of samples
+//         from - first sample
+//         to - sample after the last
+static void ssi263_render_span(ssi263_state *h, uint8_t *block, uint32_t from, uint32_t to) {
+  ssi263_synth *s = &h->synth;
+
+  if (ssi263_quiet(s)) {
+    for (uint32_t i = from; i < to; ++i) {
+      block[i] = (block[i] >> SSI263_AY3_SHIFT) + SSI263_DC;
+    }
+    return;
+  }
+
+  const int32_t recip = h->cold.recip;
+  for (uint32_t i = from; i < to; ++i) {
+    if (--s->phase_out == 0) {
+      s->phase_out = s->decimate;
+      int32_t v = ssi263_sample(s);
+      s->level = s->prev * 256;
+      s->delta = (v - s->prev) * recip;
+      s->prev  = v;
+    }
+    s->level += s->delta;
+    block[i] = (block[i] >> SSI263_AY3_SHIFT) + SSI263_DC + (s->level >> 8);
+  }
+}
+
+// Is the synthesizer silent, and settled? If so, reset it so that it can
+// be skipped. Rounding leaves the resonators ringing at a level or two,
+// so settled means inaudible rather than zero.
+static bool ssi263_quiet(ssi263_synth *s) {
+  if (s->voice || s->noise || s->target.voice || s->target.noise ||
+      (s->prev < -1) || (s->prev > 1)) {
+    return false;
+  }
+  for (unsigned int k = 0; k < 3; ++k) {
+    if ((abs(s->y1[k]) > SSI263_SETTLED) || (abs(s->y2[k]) > SSI263_SETTLED)) {
+      return false;
+    }
+  }
+  for (unsigned int k = 0; k < 3; ++k) {
+    s->y1[k] = s->y2[k] = 0;
+  }
+  s->prev = s->level = s->delta = 0;
+  return true;
+}
+
+// Generate one synthesizer sample
+static inline int32_t ssi263_sample(ssi263_synth *s) {
+  if (--s->update == 0) {
+    s->update = SSI263_UPDATE;
+    ssi263_glide(s);
+  }
+
+  // Source: glottal pulses and/or noise from a 17 bit LFSR
+  s->phase += s->target.pitch_step;
+  int32_t x = s->voice * s->tables->glottal[s->phase >> (32 - SSI263_GLOTTAL_BITS)];
+  uint32_t bit = (s->lfsr ^ (s->lfsr >> 3)) & 0x01;
+  s->lfsr = (s->lfsr >> 1) | (bit << 16);
+  x += (s->lfsr & 0x01) ? s->noise * SSI263_NOISE : -(s->noise * SSI263_NOISE);
+  x >>= 4;
+
+  // Formant resonators, in cascade
+  for (unsigned int k = 0; k < 3; ++k) {
+    int32_t y = (s->g[k] * x + s->a1[k] * s->y1[k] + s->a2[k] * s->y2[k]) >> 13;
+    y = (y < -SSI263_CLAMP) ? -SSI263_CLAMP : ((y > SSI263_CLAMP) ? SSI263_CLAMP : y);
+    s->y2[k] = s->y1[k];
+    s->y1[k] = y;
+    x = y;
+  }
+
+  x = (x * s->target.amplitude) >> SSI263_OUT_SHIFT;
+  return (x < -SSI263_OUT_MAX) ? -SSI263_OUT_MAX : ((x > SSI263_OUT_MAX) ? SSI263_OUT_MAX : x);
+}
+
+// Move the formants and source amplitudes a step towards their targets,
+// and look up the resonator coefficients. Called every SSI263_UPDATE
+// synthesizer samples, so that phonemes blend into each other at the rate
+// set by the articulation register.
+static void ssi263_glide(ssi263_synth *s) {
+  const ssi263_params *t = &s->target;
+  for (unsigned int k = 0; k < 3; ++k) {
+    int f = s->formant[k];
+    if (f < t->formant[k]) {
+      f = (f + t->glide > t->formant[k]) ? t->formant[k] : f + t->glide;
+    } else if (f > t->formant[k]) {
+      f = (f - t->glide < t->formant[k]) ? t->formant[k] : f - t->glide;
+    }
+    s->formant[k] = f;
+    s->a1[k] = s->tables->a1[k][f];
+    s->a2[k] = s->tables->a2[k][f];
+    s->g[k]  = SSI263_ONE - s->a1[k] - s->a2[k];
+  }
+  if (s->voice != t->voice) {
+    s->voice += (s->voice < t->voice) ? 1 : -1;
+  }
+  if (s->noise != t->noise) {
+    s->noise += (s->noise < t->noise) ? 1 : -1;
+  }
+}
+
@@ -0,0 +1,209 @@
+//
+// Emulation of Silicon Systems SSI-263 Speech Chip
+//
+// On the Mockingboard the SSI-263 has its own chip select and register
+// select lines on the Apple II bus, and its A/R' output drives CA1 of the
+// 6522, which the driver uses (polled through VIAREG_IFR or as an IRQ) to
+// feed it the next phoneme.
+//
+// The chip is a formant synthesizer. We model it as a glottal pulse or
+// noise source through a cascade of three resonators (F1-F3), with the
+// formant targets, amplitudes and durations of each of the 64 phonemes
+// taken from a table. These are approximations chosen to be intelligible,
+// not measurements of the real part.
+//
+// The work is split so that almost nothing happens per clock:
+// - ssi263_clk() only counts down the phoneme duration, to raise A/R' on
+//   the right clock, and logs register writes as timestamped events.
+// - The audio is rendered a block at a time by ssi263_block(), which sits
+//   in the AY3's block sink chain and mixes speech into each completed
+//   block before passing it on. The events are replayed at the matching
+//   sample positions.
+// - The synthesizer runs at a fraction of the output rate (about 16kHz,
+//   which is plenty for speech) and is interpolated up, and every filter
+//   coefficient comes from tables built once in create_ssi263().
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "wdc6522.h"
+#include "ay-3-8913.h"
+#include "arena.h"
+
+// SSI-263 Register names
+#define SSIREG_DURPHON 0  // Duration mode (bits 7-6), phoneme (bits 5-0)
+#define SSIREG_INFLECT 1  // Inflection I10..I3
+#define SSIREG_RATEINF 2  // Rate (bits 7-4), I11 (bit 3), I2..I0 (bits 2-0)
+#define SSIREG_CTLAMP  3  // Control (bit 7), articulation (bits 6-4), amplitude (bits 3-0)
+#define SSIREG_FILFREQ 4  // Filter frequency
+
+// Default configuration, used when create_ssi263() is passed NULL
+#define SSI263_DEFAULT_CLOCKSPEED AY3_DEFAULT_CLOCKSPEED
+#define SSI263_DEFAULT_SAMPLERATE AY3_DEFAULT_SAMPLERATE
+#define SSI263_DEFAULT_SYNTHRATE  16000
+
+#define SSI263_PHONEMES   64
+#define SSI263_FREQ_STEP  50    // Resolution of formant frequencies (Hz)
+#define SSI263_FREQ_STEPS 160   // Formant frequencies covered by the tables
+#define SSI263_FF_NOMINAL 0xe6  // Filter frequency the phoneme table is for
+#define SSI263_GLOTTAL_BITS 6   // log2 of entries in the glottal pulse table
+#define SSI263_GLOTTAL    (1 << SSI263_GLOTTAL_BITS)
+#define SSI263_EVENTS     16    // Register writes logged between blocks
+
+// Configuration of SSI-263
+typedef struct {
+  uint32_t clockspeed;  // Rate at which ssi263_clk() is called (Hz)
+  uint32_t samplerate;  // Sample rate of the blocks mixed into (Hz)
+  uint32_t synthrate;   // Nominal rate of the formant synthesizer (Hz)
+  bool     trace;       // Log register accesses to stdout
+} ssi263_config;
+
+// Synthesis parameters, derived from the registers whenever one is written
+typedef struct {
+  uint32_t pitch_step;  // Glottal phase increment per synthesizer sample
+  uint8_t  formant[3];  // Formant targets, in units of SSI263_FREQ_STEP
+  uint8_t  voice;       // Voicing amplitude, 0-15
+  uint8_t  noise;       // Frication amplitude, 0-15
+  uint8_t  amplitude;   // Output amplitude, 0-15
+  uint8_t  glide;       // Formant movement per update, from articulation
+} ssi263_params;
+
+// Register write, to be applied from a given clock
+typedef struct {
+  uint64_t      clock;
+  ssi263_params params;
+} ssi263_event;
+
+// Tables built in create_ssi263()
+typedef struct {
+  int16_t  a1[3][SSI263_FREQ_STEPS];     // Resonator coefficients (2.13)
+  int16_t  a2[3][SSI263_FREQ_STEPS];
+  int16_t  glottal[SSI263_GLOTTAL];      // One period of glottal pulse
+  uint32_t duration[SSI263_PHONEMES];    // Nominal phoneme durations (clocks)
+} ssi263_tables;
+
+// Hot state of SSI-263, touched on every clock
+typedef struct {
+  uint64_t clocks;      // Clocks emulated
+  uint32_t countdown;   // Clocks until the phoneme ends, 0 if not timing
+} ssi263_hot;
+
+// Synthesizer state, touched on every sample of a block
+typedef struct {
+  const ssi263_tables *tables;
+  ssi263_params target; // Parameters being moved towards
+  uint32_t phase;       // Glottal phase
+  uint32_t lfsr;        // Noise shift register
+  int32_t  y1[3];       // Resonator outputs, one and two samples ago
+  int32_t  y2[3];
+  int16_t  a1[3];       // Current resonator coefficients (2.13)
+  int16_t  a2[3];
+  int16_t  g[3];        // Resonator input gain, for unity gain at DC
+  int32_t  prev;        // Last synthesizer sample
+  int32_t  level;       // Interpolated output (24.8)
+  int32_t  delta;       // Interpolation step per output sample (24.8)
+  uint8_t  formant[3];  // Current formants
+  uint8_t  voice;       // Current voicing amplitude
+  uint8_t  noise;       // Current frication amplitude
+  uint8_t  decimate;    // Output samples per synthesizer sample
+  uint8_t  phase_out;   // Output samples until the next synthesizer sample
+  uint8_t  update;      // Synthesizer samples until the next update
+} ssi263_synth;
+
+// Cold state of SSI-263, touched only by register accesses and phoneme
+// boundaries
+typedef struct {
+  uint8_t regs[5];
+  bool    standby;      // CTL set, chip is silent
+  bool    ar_enabled;   // A/R' requests enabled
+  bool    ar;           // Level of A/R' output
+
+  // Register writes not yet rendered
+  ssi263_event events[SSI263_EVENTS];
+  uint8_t  ev_head;
+  uint8_t  ev_count;
+  uint64_t render_clock;  // Clock up to which audio has been rendered
+
+  bool     tables_owned;  // Tables were malloc()ed, not arena
+  uint32_t recip;         // 256 / synth.decimate
+  uint32_t synthrate;     // Actual synthesizer rate (Hz)
+
+  ay3_block_fn next_fn;   // Sink downstream of the SSI-263, or NULL
+  void     *next_ctx;
+
+  // Statistics
+  uint64_t phonemes;      // Phonemes started
+  uint64_t requests;      // A/R' requests for the next phoneme
+  uint64_t merged;        // Register writes merged as the event log was full
+  ssi263_config cfg;
+} ssi263_cold;
+
+// State of SSI-263
+typedef struct {
+  ssi263_hot   hot;
+  ssi263_synth synth;
+  ssi263_cold  cold;
+} ssi263_state;
+
+// Statistics of SSI-263
+typedef struct {
+  uint64_t clocks;      // Clocks emulated
+  uint64_t phonemes;    // Phonemes started
+  uint64_t requests;    // A/R' requests for the next phoneme
+  uint64_t merged;      // Register writes merged as the event log was full
+} ssi263_stats;
+
+// Fill in the default configuration
+// Params: cfg - configuration to initialize [OUT]
+void ssi263_default_config(ssi263_config *cfg);
+
+// Create an instance of SSI-263. It starts in standby, silent.
+// Params: cfg - configuration, or NULL for defaults
+//         mem - arena to allocate the tables from, or NULL to use malloc()
+// Returns an SSI-263 handle
+ssi263_state *create_ssi263(const ssi263_config *cfg, arena *mem);
+
+// Destroy an instance of SSI-263
+// Params: h - SSI-263 handle
+void destroy_ssi263(ssi263_state *h);
+
+// Called on every clock
+// Params: h - SSI-263 handle
+//         via - VIA handle of the VIA whose CA1 is connected to A/R'
+//         cs - Chip select
+//         rs - Register select (pins RS2..RS0, value 0..4)
+//         data - Data bus, written to the selected register
+void ssi263_clk(ssi263_state *h, via_state *via, bool cs, uint8_t rs, uint8_t data);
+
+// Block sink which mixes speech into each block and passes it on to the
+// next sink, if any. The AY3 samples are halved to make room for the
+// speech, so that the mix never clips. Attach with
+// ay3_set_block_sink(ay3, ssi263_block, h), after calling
+// ssi263_set_next_sink().
+// Params: ctx - SSI-263 handle
+//         block - the completed block, or NULL to request the first buffer
+//         samples - number of samples in block
+//         last - true when being detached, see ay3_block_fn
+// Returns the buffer from the next sink, or block if there is none
+uint8_t *ssi263_block(void *ctx, uint8_t *block, uint32_t samples, bool last);
+
+// Set the sink that blocks are passed on to once speech is mixed in. Must
+// be called before ssi263_block() is attached to an AY3.
+// Params: h - SSI-263 handle
+//         fn - block sink, or NULL for none
+//         ctx - context passed to fn
+void ssi263_set_next_sink(ssi263_state *h, ay3_block_fn fn, void *ctx);
+
+// Get statistics. As with ay3_get_stats(), values read from another
+// thread may be slightly stale.
+// Params: h - SSI-263 handle
+//         s - statistics [OUT]
+void ssi263_get_stats(ssi263_state *h, ssi263_stats *s);
+
+// Print the complete internal state, for debugging
+// Params: h - SSI-263 handle
+//         f - stream to print to
+void ssi263_dump(ssi263_state *h, FILE *f);
+
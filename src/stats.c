@@ -0,0 +1,131 @@
+//
+// Statistics of the emulation loop
+//
+
+#include "stats.h"
+
+// Prototypes for private functions
+static uint64_t stats_now_ns(void);
+
+static const char *stage_names[STATS_STAGE_COUNT] = {"via", "ay3", "ssi263", "block", "output"};
+
+
+void stats_init(loop_stats *l, uint32_t sample_mask) {
+  l->sample_mask = sample_mask;
+  l->underruns = 0;
+  for (unsigned int i = 0; i < STATS_STAGE_COUNT; ++i) {
+    l->stage_ticks[i] = 0;
+    l->stage_runs[i] = 0;
+  }
+  l->start_ns = l->epoch_ns = stats_now_ns();
+  l->epoch_audio_ns = 0;
+  l->next_fn = NULL;
+  l->next_ctx = NULL;
+}
+
+uint8_t *stats_block(void *ctx, uint8_t *block, uint32_t samples, bool last) {
+  loop_stats *l = ctx;
+  if (!l->next_fn) {
+    return block;
+  }
+  if (!block || last) {
+    // Attaching or detaching, not part of the loop
+    return l->next_fn(l->next_ctx, block, samples, last);
+  }
+  uint64_t t0 = stats_timestamp();
+  uint8_t *next = l->next_fn(l->next_ctx, block, samples, last);
+  stats_stage_add(l, STATS_STAGE_BLOCK, stats_timestamp() - t0);
+  return next;
+}
+
+void stats_set_next_sink(loop_stats *l, ay3_block_fn fn, void *ctx) {
+  l->next_fn  = fn;
+  l->next_ctx = ctx;
+}
+
+void stats_block_ready(loop_stats *l, uint32_t samples, uint32_t samplerate) {
+  uint64_t now = stats_now_ns();
+  if ((l->epoch_audio_ns > 0) && (now - l->epoch_ns > l->epoch_audio_ns)) {
+    // Output has run dry. Start a new epoch from here, so that one stall
+    // is counted once.
+    ++l->underruns;
+    l->epoch_ns = now;
+    l->epoch_audio_ns = 0;
+  }
+  l->epoch_audio_ns += (uint64_t)samples * 1000000000u / samplerate;
+}
+
+double stats_elapsed(const loop_stats *l) {
+  return (stats_now_ns() - l->start_ns) / 1e9;
+}
+
+void stats_dump(FILE *f, stats_format format, const loop_stats *l, ay3_state *ay3,
+                via_state *via, ssi263_state *ssi) {
+  ay3_stats a;
+  via_stats v;
+  ssi263_stats s;
+  ay3_get_stats(ay3, &a);
+  via_get_stats(via, &v);
+  if (ssi) {
+    ssi263_get_stats(ssi, &s);
+  }
+  double emulated = (double)a.clocks / ay3->cold.cfg.clockspeed;
+  double wall = l ? stats_elapsed(l) : 0.0;
+  double realtime = (wall > 0.0) ? emulated / wall : 0.0;
+
+  if (format == STATS_FORMAT_JSON) {
+    fprintf(f, "{\"clocks\":%llu,\"samples\":%llu,\"emulated_s\":%.3f,\"wall_s\":%.3f,"
+            "\"realtime\":%.2f,\"reg_writes\":%llu,\"reg_reads\":%llu,\"latches\":%llu,"
+            "\"t1_expiries\":%llu,\"t2_expiries\":%llu,\"irqs\":%llu",
+            (unsigned long long)a.clocks, (unsigned long long)a.samples, emulated, wall,
+            realtime, (unsigned long long)a.reg_writes, (unsigned long long)a.reg_reads,
+            (unsigned long long)a.latches, (unsigned long long)v.t1_expiries,
+            (unsigned long long)v.t2_expiries, (unsigned long long)v.irqs);
+    if (ssi) {
+      fprintf(f, ",\"ssi263\":{\"clocks\":%llu,\"phonemes\":%llu,\"requests\":%llu,\"merged\":%llu}",
+              (unsigned long long)s.clocks, (unsigned long long)s.phonemes,
+              (unsigned long long)s.requests, (unsigned long long)s.merged);
+    }
+    if (l) {
+      fprintf(f, ",\"underruns\":%llu,\"stages\":{", (unsigned long long)l->underruns);
+      for (unsigned int i = 0; i < STATS_STAGE_COUNT; ++i) {
+        double avg = l->stage_runs[i] ? (double)l->stage_ticks[i] / l->stage_runs[i] : 0.0;
+        fprintf(f, "%s\"%s\":{\"runs\":%llu,\"ticks\":%llu,\"avg_ticks\":%.1f}",
+                i ? "," : "", stage_names[i], (unsigned long long)l->stage_runs[i],
+                (unsigned long long)l->stage_ticks[i], avg);
+      }
+      fprintf(f, "}");
+    }
+    fprintf(f, "}\n");
+  } else {
+    fprintf(f, "clocks %llu (%.3fs emulated, %.3fs wall, %.2fx realtime)\n",
+            (unsigned long long)a.clocks, emulated, wall, realtime);
+    fprintf(f, "samples %llu\n", (unsigned long long)a.samples);
+    fprintf(f, "ay3: reg writes %llu, reg reads %llu, latches %llu\n",
+            (unsigned long long)a.reg_writes, (unsigned long long)a.reg_reads,
+            (unsigned long long)a.latches);
+    fprintf(f, "via: t1 expiries %llu, t2 expiries %llu, irqs %llu\n",
+            (unsigned long long)v.t1_expiries, (unsigned long long)v.t2_expiries,
+            (unsigned long long)v.irqs);
+    if (ssi) {
+      fprintf(f, "ssi263: clocks %llu, phonemes %llu, requests %llu, merged writes %llu\n",
+              (unsigned long long)s.clocks, (unsigned long long)s.phonemes,
+              (unsigned long long)s.requests, (unsigned long long)s.merged);
+    }
+    if (l) {
+      fprintf(f, "underruns %llu\n", (unsigned long long)l->underruns);
+      for (unsigned int i = 0; i < STATS_STAGE_COUNT; ++i) {
+        double avg = l->stage_runs[i] ? (double)l->stage_ticks[i] / l->stage_runs[i] : 0.0;
+        fprintf(f, "stage %-6s %10.1f ticks/run (%llu sampled runs)\n",
+                stage_names[i], avg, (unsigned long long)l->stage_runs[i]);
+      }
+    }
+  }
+}
+
+static uint64_t stats_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
@@ -0,0 +1,128 @@
+//
+// Statistics of the emulation loop
+//
+// The per-instance counters live in the AY3, VIA and SSI-263
+// (ay3_get_stats(), via_get_stats(), ssi263_get_stats()). This adds what only the loop driving them can see:
+// output underruns, and the time spent in each stage. Stage timing uses
+// the cheapest timestamp counter available and is only taken on one clock
+// in every (sample_mask + 1), so it costs next to nothing the rest of the
+// time. Blocks complete on a fixed cadence, which sampling could keep
+// missing, so the block sinks are timed separately on every block by
+// stats_block().
+//
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ay-3-8913.h"
+#include "ssi263.h"
+
+// Stages of the emulation loop
+typedef enum {
+  STATS_STAGE_VIA,     // via_clk()
+  STATS_STAGE_AY3,     // ay3_clk(), not counting the block sinks
+  STATS_STAGE_SSI,     // ssi263_clk()
+  STATS_STAGE_BLOCK,   // Block sinks after stats_block(), eg: ssi263_block()
+  STATS_STAGE_OUTPUT,  // Handing a completed block to the output
+  STATS_STAGE_COUNT
+} stats_stage;
+
+// State of loop statistics
+typedef struct {
+  uint32_t sample_mask;                     // Time one clock in (mask + 1)
+  uint64_t underruns;                       // Blocks ready after the output needed them
+  uint64_t stage_ticks[STATS_STAGE_COUNT];  // Timestamp ticks in sampled runs
+  uint64_t stage_runs[STATS_STAGE_COUNT];   // Number of sampled runs
+  uint64_t start_ns;                        // Start of run
+  uint64_t epoch_ns;                        // Start of current realtime epoch
+  uint64_t epoch_audio_ns;                  // Audio handed to output this epoch
+  ay3_block_fn next_fn;                     // Sink timed by stats_block(), or NULL
+  void     *next_ctx;
+} loop_stats;
+
+// Output formats for stats_dump()
+typedef enum {
+  STATS_FORMAT_TEXT,
+  STATS_FORMAT_JSON
+} stats_format;
+
+// Read the timestamp counter. The unit is counter ticks: the TSC on x86,
+// the virtual counter on arm64, otherwise nanoseconds.
+static inline uint64_t stats_timestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+// Should this clock be timed?
+// Params: l - loop statistics
+//         clock - clock number
+static inline bool stats_sample(const loop_stats *l, uint64_t clock) {
+  return (clock & l->sample_mask) == 0;
+}
+
+// Account time spent in a stage
+// Params: l - loop statistics
+//         stage - stage timed
+//         ticks - timestamp ticks spent
+static inline void stats_stage_add(loop_stats *l, stats_stage stage, uint64_t ticks) {
+  l->stage_ticks[stage] += ticks;
+  ++l->stage_runs[stage];
+}
+
+// Initialize loop statistics and start the clock
+// Params: l - loop statistics [OUT]
+//         sample_mask - time one clock in (sample_mask + 1), must be 2^n-1
+void stats_init(loop_stats *l, uint32_t sample_mask);
+
+// Block sink which passes each block on to the next sink, timing it as
+// STATS_STAGE_BLOCK. Attach with ay3_set_block_sink(ay3, stats_block, l),
+// after calling stats_set_next_sink().
+// Params: ctx - loop statistics
+//         block - the completed block, or NULL to request the first buffer
+//         samples - number of samples in block
+//         last - true when being detached, see ay3_block_fn
+// Returns the buffer from the next sink, or block if there is none
+uint8_t *stats_block(void *ctx, uint8_t *block, uint32_t samples, bool last);
+
+// Set the sink that stats_block() times. Must be called after
+// stats_init(), and before stats_block() is attached to an AY3.
+// Params: l - loop statistics
+//         fn - block sink, or NULL for none
+//         ctx - context passed to fn
+void stats_set_next_sink(loop_stats *l, ay3_block_fn fn, void *ctx);
+
+// Called when a block is ready for the output, before handing it over.
+// Counts an underrun if the audio handed over so far would already have
+// finished playing, ie: we have fallen behind realtime.
+// Params: l - loop statistics
+//         samples - samples in the block
+//         samplerate - output sample rate (Hz)
+void stats_block_ready(loop_stats *l, uint32_t samples, uint32_t samplerate);
+
+// Seconds since stats_init()
+// Params: l - loop statistics
+double stats_elapsed(const loop_stats *l);
+
+// Print all statistics for an AY3 and its VIA, and the SSI-263 if fitted
+// Params: f - stream to print to
+//         format - text or JSON (one object per line)
+//         l - loop statistics, or NULL
+//         ay3 - AY3 handle
+//         via - VIA handle
+//         ssi - SSI-263 handle, or NULL
+void stats_dump(FILE *f, stats_format format, const loop_stats *l, ay3_state *ay3,
+                via_state *via, ssi263_state *ssi);
+
@@ -15,19 +15,44 @@ static void via_write_port(uint8_t direction, uint8_t reg, uint8_t *port);
 static void via_read_port(uint8_t direction, uint8_t *reg, uint8_t port);
 static void via_timer1_expire(via_state *h);
 static void via_timer2_expire(via_state *h);
-static void via_interrupt();
+static void via_clear_flags(via_state *h, uint8_t flags);
+static void via_update_irq(via_state *h);
 
 
-via_state *create_via() {
+void via_default_config(via_config *cfg) {
+  cfg->clockspeed = VIA_DEFAULT_CLOCKSPEED;
+  cfg->phi2       = VIA_DEFAULT_CLOCKSPEED;
+  cfg->trace      = true;
+}
+
+via_state *create_via(const via_config *cfg) {
   via_state *h = malloc(sizeof(via_state));
   if (!h) {
     printf("Alloc fail!");
     exit(999);
   }
-  h->port_a = h->port_b = 0;
-  h->regs[VIAREG_IER] = 128; // Disable all interrupts
-  h->regs[VIAREG_IFR] = 0;   // Clear all interrupt flags
-  h->regs[VIAREG_ACR] = 0;   // Clear Aux Control Register
+  if (cfg) {
+    h->cold.cfg = *cfg;
+  } else {
+    via_default_config(&h->cold.cfg);
+  }
+  // Timers may not count faster than via_clk() is called
+  if ((h->cold.cfg.clockspeed == 0) || (h->cold.cfg.phi2 > h->cold.cfg.clockspeed)) {
+    printf("VIA: Bad config!");
+    exit(999);
+  }
+  h->hot.timer_step  = (((uint64_t)h->cold.cfg.phi2 << VIA_FIXED_SHIFT) +
+                    h->cold.cfg.clockspeed / 2) / h->cold.cfg.clockspeed;
+  h->hot.timer_phase = 0;
+  h->hot.port_a = h->hot.port_b = 0;
+  h->hot.irqb = true;             // IRQ' released
+  h->hot.t1_counter = h->hot.t2_counter = 0;
+  h->cold.regs[VIAREG_IER] = 128; // Disable all interrupts
+  h->cold.regs[VIAREG_IFR] = 0;   // Clear all interrupt flags
+  h->cold.regs[VIAREG_ACR] = 0;   // Clear Aux Control Register
+  h->cold.regs[VIAREG_PCR] = 0;   // CA1 interrupts on negative edge
+  h->cold.ca1 = true;             // Pulled up when nothing drives it
+  h->cold.t1_expiries = h->cold.t2_expiries = h->cold.irqs = 0;
   return h;
 }
 
@@ -36,21 +61,18 @@ void destroy_via(via_state *h) {
 }
 
 void via_clk(via_state *h, bool cs1, bool cs2b, bool rwb, uint8_t rs, uint8_t data) {
-  // Decrement timer 1
-  if(--h->regs[VIAREG_T1CL] == 0xff) {
-    --h->regs[VIAREG_T1CH];
-  }
-  // Check if expired
-  if ((h->regs[VIAREG_T1CL] == 0) && (h->regs[VIAREG_T1CH] == 0)) {
-    via_timer1_expire(h);
-  }
-  // Decrement timer 2
-  if(--h->regs[VIAREG_T2CL] == 0xff) {
-    --h->regs[VIAREG_T2CH];
-  }
-  // Check if expired
-  if ((h->regs[VIAREG_T2CL] == 0) && (h->regs[VIAREG_T2CH] == 0)) {
-    via_timer2_expire(h);
+  // Timers count on phase 2, which may be slower than the host clock
+  h->hot.timer_phase += h->hot.timer_step;
+  if (h->hot.timer_phase >= VIA_FIXED_ONE) {
+    h->hot.timer_phase -= VIA_FIXED_ONE;
+    // Decrement timer 1 and check if expired
+    if (--h->hot.t1_counter == 0) {
+      via_timer1_expire(h);
+    }
+    // Decrement timer 2 and check if expired
+    if (--h->hot.t2_counter == 0) {
+      via_timer2_expire(h);
+    }
   }
 
   if (cs1 && !cs2b) {
@@ -63,56 +85,94 @@ void via_clk(via_state *h, bool cs1, bool cs2b, bool rwb, uint8_t rs, uint8_t da
   }
 }
 
+void via_set_ca1(via_state *h, bool level) {
+  if (level == h->cold.ca1) {
+    return;
+  }
+  h->cold.ca1 = level;
+  // Bit 0 of the Peripheral Control Register selects the active edge,
+  // 0 for negative, 1 for positive
+  if (level == ((h->cold.regs[VIAREG_PCR] & 0x01) != 0)) {
+    // Set CA1 interrupt flag.
+    h->cold.regs[VIAREG_IFR] |= 0x02; // Turn on bit 1
+    // If Interrupt Enable Register Bit 1 is set, then assert the interrupt
+    via_update_irq(h);
+  }
+}
+
+void via_get_stats(via_state *h, via_stats *s) {
+  s->t1_expiries = h->cold.t1_expiries;
+  s->t2_expiries = h->cold.t2_expiries;
+  s->irqs        = h->cold.irqs;
+}
+
 static void via_set_register(via_state *h, unsigned int reg, uint8_t val) {
   switch (reg) {
     case VIAREG_ORB:
-      // CPU write to Port B. Update h->port_b.
-      h->regs[reg] = val;
-      via_write_port(h->regs[VIAREG_DDRB], h->regs[reg], &(h->port_b));
+      // CPU write to Port B. Update h->hot.port_b.
+      h->cold.regs[reg] = val;
+      via_write_port(h->cold.regs[VIAREG_DDRB], h->cold.regs[reg], &(h->hot.port_b));
       break;
     case VIAREG_ORA:
-      // CPU write to Port A. Update h->port_a.
-      h->regs[reg] = val;
-      via_write_port(h->regs[VIAREG_DDRA], h->regs[reg], &(h->port_a));
+      // CPU write to Port A. Update h->hot.port_a.
+      h->cold.regs[reg] = val;
+      via_write_port(h->cold.regs[VIAREG_DDRA], h->cold.regs[reg], &(h->hot.port_a));
+      // Port A handshake: reset CA1 interrupt flag
+      via_clear_flags(h, 0x02);
+      break;
+    case VIAREG_ORA2:
+      // Same as VIAREG_ORA, without the handshake
+      h->cold.regs[VIAREG_ORA] = val;
+      via_write_port(h->cold.regs[VIAREG_DDRA], val, &(h->hot.port_a));
       break;
     case VIAREG_T1CL:
       // Timer 1 low order counter. Write to latch not counter.
-      h->regs[VIAREG_T1LL] = val;
+      h->cold.regs[VIAREG_T1LL] = val;
       break;
     case VIAREG_T1CH:
       // Timer 1 high order counter. Write to latch not counter.
-      h->regs[VIAREG_T1LH] = val;
+      h->cold.regs[VIAREG_T1LH] = val;
       // Then copy latch->counter
-      h->regs[VIAREG_T1CL] = h->regs[VIAREG_T1LL];
-      h->regs[VIAREG_T1CH] = h->regs[VIAREG_T1LH];
+      h->hot.t1_counter = h->cold.regs[VIAREG_T1LL] | (h->cold.regs[VIAREG_T1LH] << 8);
       // And reset timer 1 interrupt flag
-      h->regs[VIAREG_IFR] &= 0xbf; // Turn off bit 6
-      // Clear bit 7 if no other outstanding interrupts
-      if ((h->regs[VIAREG_IFR] & 0x7f) == 0) {
-        h->regs[VIAREG_IFR] = 0;
-      }
+      via_clear_flags(h, 0x40); // Turn off bit 6
+      break;
+    case VIAREG_T2CL:
+      // Timer 2 low order counter
+      h->cold.regs[reg] = val;
+      h->hot.t2_counter = (h->hot.t2_counter & 0xff00) | val;
       break;
     case VIAREG_T2CH:
       // Timer 2 high order counter
-      h->regs[reg] = val;
+      h->cold.regs[reg] = val;
+      h->hot.t2_counter = (h->hot.t2_counter & 0x00ff) | (val << 8);
       // And reset timer 2 interrupt flag
-      h->regs[VIAREG_IFR] &= 0xdf; // Turn off bit 5
-      // Clear bit 7 if no other outstanding interrupts
-      if ((h->regs[VIAREG_IFR] & 0x7f) == 0) {
-        h->regs[VIAREG_IFR] = 0;
-      }
+      via_clear_flags(h, 0x20); // Turn off bit 5
+      break;
+    case VIAREG_IFR:
+      // Writing a 1 to a bit of the interrupt flag register clears it
+      via_clear_flags(h, val & 0x7f);
       break;
     case VIAREG_IER:
       // When writing to the interrupt enable register, bit 7 controls
-      // whether the other bits mean set or clear.
-      if (val < 128) {
-        // Bit seven clear. Flip all bits.
-        val = ~val;
+      // whether the bits written set or clear their enables. The others
+      // are left alone, and bit 7 always reads as 1.
+      if (val & 0x80) {
+        h->cold.regs[reg] |= val;
+      } else {
+        h->cold.regs[reg] &= ~val;
+      }
+      if (h->cold.cfg.trace) {
+        printf("VIA: setting R%d to 0x%x\n", reg, h->cold.regs[reg]);
       }
-      h->regs[reg] = val;
+      // Enabling a flag already set asserts the interrupt
+      via_update_irq(h);
+      break;
     default:
-      printf("VIA: setting R%d to 0x%x\n", reg, val);
-      h->regs[reg] = val;
+      if (h->cold.cfg.trace) {
+        printf("VIA: setting R%d to 0x%x\n", reg, val);
+      }
+      h->cold.regs[reg] = val;
   }
 }
 
@@ -120,30 +180,38 @@ static uint8_t via_get_register(via_state *h, unsigned int reg) {
   switch (reg) {
     case VIAREG_IRB:
       // CPU read from Port B. Update VIAREG_IRB.
-      via_read_port(h->regs[VIAREG_DDRB], &(h->regs[reg]), h->port_b);
+      via_read_port(h->cold.regs[VIAREG_DDRB], &(h->cold.regs[reg]), h->hot.port_b);
       break;
     case VIAREG_IRA:
       // CPU read from Port A. Update VIAREG_IRA.
-      via_read_port(h->regs[VIAREG_DDRA], &(h->regs[reg]), h->port_a);
+      via_read_port(h->cold.regs[VIAREG_DDRA], &(h->cold.regs[reg]), h->hot.port_a);
+      // Port A handshake: reset CA1 interrupt flag
+      via_clear_flags(h, 0x02);
+      break;
+    case VIAREG_IRA2:
+      // Same as VIAREG_IRA, without the handshake
+      via_read_port(h->cold.regs[VIAREG_DDRA], &(h->cold.regs[VIAREG_IRA]), h->hot.port_a);
+      return h->cold.regs[VIAREG_IRA];
+    case VIAREG_T1CH:
+      // Timer 1 high order counter
+      h->cold.regs[reg] = h->hot.t1_counter >> 8;
+      break;
+    case VIAREG_T2CH:
+      // Timer 2 high order counter
+      h->cold.regs[reg] = h->hot.t2_counter >> 8;
       break;
     case VIAREG_T1CL:
       // Timer 1 low order counter. Reset T1 interrupt flag.
-      h->regs[VIAREG_IFR] &= 0xbf; // Turn off bit 6
-      // Clear bit 7 if no other outstanding interrupts
-      if ((h->regs[VIAREG_IFR] & 0x7f) == 0) {
-        h->regs[VIAREG_IFR] = 0;
-      }
+      h->cold.regs[reg] = h->hot.t1_counter & 0xff;
+      via_clear_flags(h, 0x40); // Turn off bit 6
       break;
     case VIAREG_T2CL:
       // Timer 2 low order counter. Reset T2 interrupt flag.
-      h->regs[VIAREG_IFR] &= 0xdf; // Turn off bit 5
-      // Clear bit 7 if no other outstanding interrupts
-      if ((h->regs[VIAREG_IFR] & 0x7f) == 0) {
-        h->regs[VIAREG_IFR] = 0;
-      }
+      h->cold.regs[reg] = h->hot.t2_counter & 0xff;
+      via_clear_flags(h, 0x20); // Turn off bit 5
       break;
   }
-  return h->regs[reg];
+  return h->cold.regs[reg];
 }
 
 // Handle CPU writing to Port A or Port B
@@ -165,24 +233,21 @@ static void via_read_port(uint8_t direction, uint8_t *reg, uint8_t port) {
 // Called when timer 1 expires
 // Handles one-shot and continuous mode
 static void via_timer1_expire(via_state *h) {
-
   // Bit 6 of the Aux Control Register determines mode
   // If we are in continuous mode, rearm the timer
-  if (h->regs[VIAREG_ACR] & 0x40) {
+  if (h->cold.regs[VIAREG_ACR] & 0x40) {
     // Copy latch->counter
-    h->regs[VIAREG_T1CL] = h->regs[VIAREG_T1LL];
-    h->regs[VIAREG_T1CH] = h->regs[VIAREG_T1LH];
+    h->hot.t1_counter = h->cold.regs[VIAREG_T1LL] | (h->cold.regs[VIAREG_T1LH] << 8);
   }
 
   // If we are in continuous mode, OR if the Timer 1 interrupt flag has not yet been asserted
-  if ((h->regs[VIAREG_ACR] & 0x40) || ((h->regs[VIAREG_IFR] & 0x40) == 0)) {
-    // Set Timer 1 interrupt flag.
-    h->regs[VIAREG_IFR] |= 0x40; // Turn on bit 6
-    h->regs[VIAREG_IFR] |= 0x80; // Turn on bit 7 (any interrupt)
+  if ((h->cold.regs[VIAREG_ACR] & 0x40) || ((h->cold.regs[VIAREG_IFR] & 0x40) == 0)) {
+    // Set Timer 1 interrupt flag. Only this is counted, as a one-shot timer
+    // nobody has armed still wraps every 65536 cycles.
+    ++h->cold.t1_expiries;
+    h->cold.regs[VIAREG_IFR] |= 0x40; // Turn on bit 6
     // If Interrupt Enable Register Bit 6 is set, then assert the interrupt
-    if (h->regs[VIAREG_IER] & 0x40) {
-      via_interrupt();
-    }
+    via_update_irq(h);
   }
 }
 
@@ -191,20 +256,37 @@ static void via_timer1_expire(via_state *h) {
 //       So there is only one-shot mode to consider for timer 2.
 static void via_timer2_expire(via_state *h) {
   // If the Timer 2 interrupt flag is not asserted yet
-  if ((h->regs[VIAREG_IFR] & 0x20) == 0) {
-    // Set Timer 2 interrupt flag.
-    h->regs[VIAREG_IFR] |= 0x20; // Turn on bit 5
-    h->regs[VIAREG_IFR] |= 0x80; // Turn on bit 7 (any interrupt)
+  if ((h->cold.regs[VIAREG_IFR] & 0x20) == 0) {
+    // Set Timer 2 interrupt flag. As for timer 1, only this is counted.
+    ++h->cold.t2_expiries;
+    h->cold.regs[VIAREG_IFR] |= 0x20; // Turn on bit 5
     // If Interrupt Enable Register Bit 5 is set, then assert the interrupt
-    if (h->regs[VIAREG_IER] & 0x20) {
-      via_interrupt();
-    }
+    via_update_irq(h);
   }
 }
 
-// Called when the VIA wants to raise an IRQ
-static void via_interrupt() {
-  // TODO: Wire this up
+// Reset interrupt flags, releasing IRQ' if no enabled interrupts remain
+// Params: h - VIA handle
+//         flags - bits of the interrupt flag register to reset
+static void via_clear_flags(via_state *h, uint8_t flags) {
+  h->cold.regs[VIAREG_IFR] &= ~flags;
+  via_update_irq(h);
+}
+
+// Called whenever VIAREG_IFR or VIAREG_IER changes. Bit 7 of VIAREG_IFR is
+// set, and IRQ' pulled low, while any enabled interrupt flag is set.
+// Params: h - VIA handle
+static void via_update_irq(via_state *h) {
+  bool active = (h->cold.regs[VIAREG_IFR] & h->cold.regs[VIAREG_IER] & 0x7f) != 0;
+  if (active) {
+    h->cold.regs[VIAREG_IFR] |= 0x80;  // Turn on bit 7 (any interrupt)
+    if (h->hot.irqb) {
+      ++h->cold.irqs;
+    }
+  } else {
+    h->cold.regs[VIAREG_IFR] &= 0x7f;  // Turn off bit 7
+  }
+  h->hot.irqb = !active;
 }
 
 
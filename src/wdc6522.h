@@ -10,14 +10,15 @@
 //   read or write handshaking for port B.
 // - Pins PB3-PB7 are not connected. Hence there is no need to support the 
 //   timer 1 PB7 output mode or the timer 2 PB6 pulse counting mode.
-// - CA2 is also not connected. (If an SSI-263 chip is installed the A/R'
-//   output (pin 4) goes to CA1 to signal that the SSI is ready for another
-//   phoneme.  Otherwise CA1 is also not connected.
-// - In the first instance we will assume no SSI-263 speech chip, but this may
-//   be added later.
-// - So we don't need read or write handshaking on port A either for now, and
-//   we will completely ignore VIAREG_PCR since no CA1/2,CB1/2. Will
-//   need to implement the CA1 support when we add SSI capability later on.
+// - CA2 is also not connected. If an SSI-263 speech chip is installed its
+//   A/R' output (pin 4) goes to CA1 to signal that the SSI is ready for
+//   another phoneme.  Otherwise CA1 is also not connected.
+// - So the only handshaking needed is CA1 on port A: the active edge is
+//   selected by bit 0 of VIAREG_PCR and sets bit 1 of VIAREG_IFR, which is
+//   reset by reading or writing VIAREG_ORA. The CA2 bits of VIAREG_PCR are
+//   ignored.
+// - IRQ' (via_hot.irqb) is pulled low while any interrupt flag enabled in
+//   VIAREG_IER is set, and released when the last is reset.
 //
 
 #pragma once
@@ -46,28 +47,76 @@
 #define VIAREG_ORA2 15  // Same as reg 1 except no 'handshake'
 #define VIAREG_IRA2 15  // Same as reg 1 except no 'handshake'
 
-// State of VIA
+// Default configuration, used when create_via() is passed NULL
+#define VIA_DEFAULT_CLOCKSPEED 1020500   // Host CPU clock (NTSC Apple II)
+
+#define VIA_FIXED_SHIFT 16
+#define VIA_FIXED_ONE   (1u << VIA_FIXED_SHIFT)
+
+// Configuration of VIA
+typedef struct {
+  uint32_t clockspeed;  // Rate at which via_clk() is called (Hz)
+  uint32_t phi2;        // Phase 2 clock driving the timers (Hz)
+  bool     trace;       // Log register accesses to stdout
+} via_config;
+
+// Hot state of VIA, touched on every clock
+typedef struct {
+  uint32_t timer_phase;
+  uint32_t timer_step;  // Timer decrements per via_clk(), 16.16 fixed-point
+  uint16_t t1_counter;  // Timer 1 counter (VIAREG_T1CH:VIAREG_T1CL)
+  uint16_t t2_counter;  // Timer 2 counter (VIAREG_T2CH:VIAREG_T2CL)
+
+  uint8_t port_a; // Mockingboard: Connects to/from AY-3-8913 databus (DA0..DA7)
+  uint8_t port_b; // Mockingboard: 3 bits to AY-3-8913 (PB0-BC1, PB1-BDIR, PB2-RESET)
+  bool    irqb;   // Mockingboard: Connects to Apple II IRQ' (active low)
+} via_hot;
+
+// Cold state of VIA, touched only by register accesses and timer expiry.
+// The timer counter entries of regs[] are not maintained; the counters
+// live in via_hot.
 typedef struct {
   uint8_t regs[16];
 
+  via_config cfg;
+
   bool    cs1;    // Chip select 1 (CS1)
   bool    cs2b;   // Chip select 2 (CS2' active low)
   bool    rwb;    // RW' (active low)
   uint8_t rs;     // Register select (RS3..RS0, value 0..15)
 
-  uint8_t port_a; // Mockingboard: Connects to/from AY-3-8913 databus (DA0..DA7)
-  uint8_t port_b; // Mockingboard: 3 bits to AY-3-8913 (PB0-BC1, PB1-BDIR, PB2-RESET)
   bool    ca1;    // Mockingboard: Only used if SSI-263 speech chip installed (A/R')
   bool    ca2;    // Mockingboard: Not used
   bool    cb1;    // Mockingboard: Not used
   bool    cb2;    // Mockingboard: Not used
-  bool    irqb;   // Mockingboard: Connects to Apple II IRQ
-  
+
+  // Statistics
+  uint64_t t1_expiries;
+  uint64_t t2_expiries;
+  uint64_t irqs;
+} via_cold;
+
+// State of VIA
+typedef struct {
+  via_hot  hot;
+  via_cold cold;
 } via_state;
 
+// Statistics of VIA
+typedef struct {
+  uint64_t t1_expiries; // Timer 1 expiries that set its interrupt flag
+  uint64_t t2_expiries; // Timer 2 expiries that set its interrupt flag
+  uint64_t irqs;        // Times IRQ' was pulled low
+} via_stats;
+
+// Fill in the default configuration
+// Params: cfg - configuration to initialize [OUT]
+void via_default_config(via_config *cfg);
+
 // Create an instance of the VIA 6522
+// Param: cfg - configuration, or NULL for defaults
 // Returns VIA handle.
-via_state *create_via();
+via_state *create_via(const via_config *cfg);
 
 // Destroy an instance of the VIA 6522
 // Param: h - VIA handle
@@ -82,6 +131,18 @@ void destroy_via(via_state *h);
 //        data - Data bus
 void via_clk(via_state *h, bool cs1, bool cs2b, bool rwb, uint8_t rs, uint8_t data);
 
+// Drive the CA1 input. Called by the device connected to CA1 whenever its
+// output may have changed.
+// Param: h     - VIA handle
+//        level - level of CA1
+void via_set_ca1(via_state *h, bool level);
+
+// Get statistics. As with ay3_get_stats(), values read from another
+// thread may be slightly stale.
+// Param: h - VIA handle
+//        s - statistics [OUT]
+void via_get_stats(via_state *h, via_stats *s);
+
 
 
 